@@ -16,20 +16,29 @@ public:
   Bitstream(const bool&);
   Bitstream(std::uint8_t[], int);
   Bitstream(const Bitstream&);
+  Bitstream(Bitstream&&) noexcept;
   Bitstream(const std::string&);
   Bitstream(const std::uint8_t, int);
   Bitstream(const unsigned int, int);
 
-  Bitstream operator+(const Bitstream&);
+  Bitstream& operator=(const Bitstream&);
+  Bitstream& operator=(Bitstream&&) noexcept;
+
+  Bitstream operator+(const Bitstream&) const;
   Bitstream& operator+=(const Bitstream&);
+  Bitstream& operator+=(Bitstream&&);
+
+  Bitstream& append(const std::uint8_t*, const int);
+  Bitstream& append_aligned(const std::uint8_t*, const std::size_t);
+  Bitstream& put(const std::uint32_t, const int);
 
+  void reserve(const std::size_t);
   bool byte_align();
-  Bitstream rbsp_trailing_bits();
-  Bitstream rbsp_to_ebsp();
+  Bitstream& rbsp_trailing_bits();
+  Bitstream& rbsp_to_ebsp(const std::size_t = 0);
 
   // for testing
   std::string to_string();
 };
 
 #endif // BITSTREAM
-
@@ -6,28 +6,54 @@
 
 #define PIXELS_PER_BLOCK 8*8
 
-class Block2x2 {
+/* Rows x Cols samples inside a larger array, no copy of the samples
+ *
+ * Row r starts at base + r * stride, the samples of a row are Step
+ * apart. Step is 1 for the 4x4 blocks, so every row is contiguous and
+ * the loops over it can be vectorized; the DC coefficients of a
+ * macroblock sit 4 apart. index is in raster order as in a plain array.
+ */
+template <int Rows, int Cols, int Step = 1>
+class BlockView {
 private:
-  std::array<std::reference_wrapper<int>, 4> data;
+  int* base;
+  int stride;
 
 public:
-  Block2x2(int& e1, int& e2, int &e3, int &e4) : data{{e1, e2, e3, e4}} {}
-
-  int& operator[](int index) { return data[index].get(); }
-  decltype(std::begin(data)) begin() { return std::begin(data); }
-  decltype(std::end(data)) end() { return std::end(data); }
+  static const int rows = Rows;
+  static const int cols = Cols;
+  static const int size = Rows * Cols;
+
+  BlockView(int* _base, const int _stride): base(_base), stride(_stride) {}
+
+  int& operator()(const int row, const int col) const { return base[row * stride + col * Step]; }
+  int& operator[](const int index) const { return (*this)(index / Cols, index % Cols); }
+  int* row(const int r) const { return base + r * stride; }
+
+  // gather into / scatter from size samples in raster order
+  void copy_to(int* dst) const {
+    for (int r = 0; r < Rows; r++)
+      for (int c = 0; c < Cols; c++)
+        dst[r * Cols + c] = (*this)(r, c);
+  }
+  void copy_from(const int* src) const {
+    for (int r = 0; r < Rows; r++)
+      for (int c = 0; c < Cols; c++)
+        (*this)(r, c) = src[r * Cols + c];
+  }
 };
 
-class Block4x4 {
-private:
-  std::array<std::reference_wrapper<int>, 16> data;
+using Block4x4 = BlockView<4, 4>;
+using Block2x2 = BlockView<2, 2, 4>;  // chroma DC
+using LumaDCBlock = BlockView<4, 4, 4>;
 
+/* 4x4 block of an intra16x16 or chroma macroblock
+ * its first sample holds the DC coefficient, which is coded in the DC
+ * block, so the AC scan leaves it out
+ */
+class ACBlock4x4 : public Block4x4 {
 public:
-  Block4x4(int& e1, int& e2, int &e3, int &e4, int &e5, int &e6, int &e7, int &e8, int &e9, int &e10, int &e11, int &e12, int &e13, int &e14, int &e15, int &e16) : data{{e1, e2, e3, e4, e5, e6, e7, e8, e9, e10, e11, e12, e13, e14, e15, e16}} {};
-
-  int& operator[](int index) { return data[index].get(); }
-  decltype(std::begin(data)) begin() { return std::begin(data); }
-  decltype(std::end(data)) end() { return std::end(data); }
+  using Block4x4::Block4x4;
 };
 
 using Block8x8 = std::array<int, 8*8>;
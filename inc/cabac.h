@@ -0,0 +1,79 @@
+#ifndef CABAC
+#define CABAC
+
+#include <cstdint>
+
+#include "bitstream.h"
+#include "vlc.h"
+
+// contexts of the I slice syntax elements, ctxIdx 0 - 275
+const int CABAC_NB_CTX = 276;
+
+/* ctxIdxOffset of the I slice syntax elements
+ */
+enum {
+  CTX_MB_TYPE_I = 3,
+  CTX_MB_QP_DELTA = 60,
+  CTX_INTRA_CHROMA_PRED_MODE = 64,
+  CTX_PREV_INTRA4x4_PRED_MODE = 68,
+  CTX_REM_INTRA4x4_PRED_MODE = 69,
+  CTX_CBP_LUMA = 73,
+  CTX_CBP_CHROMA = 77,
+  CTX_CODED_BLOCK_FLAG = 85,
+  CTX_SIGNIFICANT_COEFF = 105,
+  CTX_LAST_SIGNIFICANT_COEFF = 166,
+  CTX_COEFF_ABS_LEVEL = 227
+};
+
+/* ctxBlockCat of the residual blocks
+ */
+enum class BlockCat {
+  LUMA_DC,
+  LUMA_AC,
+  LUMA_4x4,
+  CHROMA_DC,
+  CHROMA_AC
+};
+
+/* Context adaptive binary arithmetic coder
+ *
+ * Follows the encoding engine of the standard: 9-bit range, 10-bit low
+ * and outstanding bits resolved on the next output bit. Each context
+ * is one byte, pStateIdx << 1 | valMPS, stepped through transition
+ * tables. Output bits are gathered in a word before they go into the
+ * bitstream.
+ */
+class CABACEncoder {
+public:
+  CABACEncoder(Bitstream&);
+
+  void init_contexts(const int);
+  void init_engine();
+
+  void encode_decision(const int, const int);
+  void encode_bypass(const int);
+  void encode_terminate(const int);
+  void encode_exp_golomb_bypass(int);
+
+  void encode_empty_block(const BlockCat, const int);
+  void encode_residual_block(const ScannedBlock&, const BlockCat, const int);
+
+private:
+  Bitstream& bitstream;
+  std::uint8_t contexts[CABAC_NB_CTX];
+
+  std::uint32_t low;
+  std::uint32_t range;
+  int outstanding;
+  bool first_bit;
+
+  std::uint32_t pending;
+  int nb_pending;
+
+  void renorm();
+  void put_bit(const int);
+  void write_bits(const std::uint32_t, const int);
+  void flush();
+};
+
+#endif // CABAC
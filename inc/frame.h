@@ -2,8 +2,10 @@
 #define FRAME
 
 #include <vector>
+#include <cstdint>
 
 #include "log.h"
+#include "bitstream.h"
 #include "macroblock.h"
 
 enum {
@@ -54,8 +56,20 @@ public:
   int nb_mb_cols;
   std::vector<MacroBlock> mbs;
 
+  // entropy coded residual of all macroblocks, each one starts byte-aligned
+  Bitstream mb_bitstream;
+
+  // FrameCache: hash and source samples of every MB row, the leading
+  // rows already coded and the reconstruction before deblocking
+  std::vector<std::uint64_t> row_hashes;
+  std::vector<int> row_samples;
+  int cached_rows;
+  std::vector<MacroBlock> decoded_blocks;
+
   Frame(const PadFrame&);
+  bool is_duplicate() const { return cached_rows == nb_mb_rows; }
   int get_neighbor_index(const int, const int);
+  int predict_intra4x4_mode(MacroBlock&, const int);
 };
 
 #endif
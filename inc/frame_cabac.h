@@ -0,0 +1,10 @@
+#ifndef FRAME_CABAC
+#define FRAME_CABAC
+
+#include "frame.h"
+#include "macroblock.h"
+#include "cabac.h"
+
+void cabac_frame(Frame&);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef FRAME_CACHE
+#define FRAME_CACHE
+
+#include <cstdint>
+#include <vector>
+
+#include "log.h"
+#include "bitstream.h"
+#include "macroblock.h"
+#include "frame.h"
+
+/* Reuse of the last coded frame for static content, -dedup
+ *
+ * Every picture is an IDR coded as one slice, so a frame equal to the
+ * last coded one gives the same slice data, only idr_pic_id and
+ * pic_order_cnt_lsb of the slice header differ. Each MB row of a new
+ * frame is hashed before coding and compared with the cached frame:
+ *   all rows equal      the coded macroblocks and their bitstream are
+ *                       copied, mode decision and entropy coding are
+ *                       skipped, the Writer adds a fresh slice header
+ *   leading rows equal  their coded and reconstructed macroblocks are
+ *                       copied and only the rows below are coded, intra
+ *                       prediction never looks further down
+ * Rows are compared by a 64-bit hash first and by their samples when
+ * the hashes match. With frame threads the frames of a batch are
+ * compared with the last one of the batch before.
+ */
+class FrameCache {
+public:
+  static bool enabled;
+
+  FrameCache();
+  void lookup(Frame&);
+  void store(const Frame&);
+
+private:
+  Log logger;
+  std::vector<std::uint64_t> row_hashes;
+  std::vector<int> row_samples;
+  std::vector<MacroBlock> mbs;
+  std::vector<MacroBlock> decoded_blocks;
+  Bitstream mb_bitstream;
+};
+
+#endif // FRAME_CACHE
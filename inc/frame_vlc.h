@@ -4,18 +4,39 @@
 #include <array>
 #include <vector>
 #include <tuple>
+#include <cstdint>
 
 #include "frame.h"
 #include "io.h"
 #include "macroblock.h"
 #include "vlc.h"
 
-void vlc_frame(Frame&);
-Bitstream vlc_Y_DC(MacroBlock&, std::vector<std::array<int, 16>>&, Frame&);
-Bitstream vlc_Y(int, MacroBlock&, std::vector<std::array<int, 16>>&, Frame&);
+/* TotalCoeff of every coded 4x4 block, the context for nC
+ *
+ * One flat grid of 4x4 blocks per colour component, with a border row
+ * on top and a border column on the left marked as unavailable, so a
+ * block reads its left and upper neighbours without any check. The
+ * grids are sized on the first frame and reused for the next ones.
+ */
+class NCContext {
+public:
+  static const int unavailable = 0x80;
+
+  int Y_stride = 0;
+  int C_stride = 0;
+  std::vector<std::uint8_t> Y;
+  std::vector<std::uint8_t> Cb;
+  std::vector<std::uint8_t> Cr;
+
+  void reset(const Frame&);
+};
+
+void vlc_frame(Frame&, NCContext&);
+Bitstream vlc_Y_DC(MacroBlock&, const std::uint8_t*, const int);
+Bitstream vlc_Y(int, MacroBlock&, std::uint8_t*, const int);
 Bitstream vlc_Cb_DC(MacroBlock&);
 Bitstream vlc_Cr_DC(MacroBlock&);
-Bitstream vlc_Cb_AC(int, MacroBlock&, std::vector<std::array<int, 4>>&, Frame&);
-Bitstream vlc_Cr_AC(int, MacroBlock&, std::vector<std::array<int, 4>>&, Frame&);
+Bitstream vlc_Cb_AC(int, MacroBlock&, std::uint8_t*, const int);
+Bitstream vlc_Cr_AC(int, MacroBlock&, std::uint8_t*, const int);
 
 #endif
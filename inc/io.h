@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <vector>
 #include <cmath>
+#include <memory>
 
 #include "log.h"
 #include "vlc.h"
@@ -12,6 +13,8 @@
 #include "qdct.h"
 #include "frame.h"
 #include "bitstream.h"
+#include "sink.h"
+#include "muxer.h"
 
 class Reader {
 private:
@@ -35,25 +38,34 @@ public:
 
 class Writer {
 public:
-  Writer(std::string);
+  Writer(std::string, std::string = "264", const int = 30, const int = 0, const bool = false);
+  Writer(std::unique_ptr<Sink>, const bool = false);
+  Writer(std::unique_ptr<Muxer>, const bool = false);
+
+  bool cabac() const { return entropy_coding_mode; }
 
   void write_sps(const int, const int, const int);
   void write_pps();
   void write_slice(const int, Frame&);
+  void write_slices(const std::vector<const Bitstream*>&);
+  Bitstream package_slice(const int, Frame&) const;
 
 private:
   Log logger;
-  std::fstream file;
-  static std::uint8_t stopcode[4];
+  std::unique_ptr<Muxer> muxer;
+  bool entropy_coding_mode;
+  Bitstream sps;
+  int width;
+  int height;
   unsigned int log2_max_frame_num;
   unsigned int log2_max_pic_order_cnt_lsb;
 
   Bitstream seq_parameter_set_rbsp(const int, const int, const int);
   Bitstream pic_parameter_set_rbsp();
-  Bitstream write_slice_data(Frame&, Bitstream&);
-  Bitstream mb_pred(MacroBlock&, Frame&);
-  Bitstream slice_layer_without_partitioning_rbsp(const int, Frame&);
-  Bitstream slice_header(const int);
+  Bitstream& write_slice_data(Frame&, Bitstream&) const;
+  Bitstream mb_pred(MacroBlock&, Frame&) const;
+  Bitstream& slice_layer_without_partitioning_rbsp(const int, Frame&, Bitstream&) const;
+  Bitstream slice_header(const int) const;
 };
 
 #endif // IO
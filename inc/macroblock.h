@@ -2,14 +2,30 @@
 #define MACROBLOCK
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
+#include <type_traits>
 
 #include "block.h"
 #include "intra.h"
-#include "bitstream.h"
 
 #define BLOCKS_PER_MB 4+1+1
 
+/* Bits of MacroBlock::nonzero_mask
+ *   0-15   luma 4x4 blocks in coding order, AC only for intra16x16
+ *   16-19  Cb AC blocks
+ *   20-23  Cr AC blocks
+ *   24-26  luma DC, Cb DC, Cr DC
+ */
+const std::uint32_t NONZERO_LUMA = 0x0000ffff;
+const int NONZERO_CB_AC_SHIFT = 16;
+const int NONZERO_CR_AC_SHIFT = 20;
+const std::uint32_t NONZERO_CHROMA_AC = 0x00ff0000;
+const std::uint32_t NONZERO_LUMA_DC = 1 << 24;
+const std::uint32_t NONZERO_CB_DC = 1 << 25;
+const std::uint32_t NONZERO_CR_DC = 1 << 26;
+
 class MacroBlock {
 public:
   int mb_row;
@@ -31,24 +47,33 @@ public:
   bool coded_block_pattern_chroma_DC = false;
   bool coded_block_pattern_chroma_AC = false;
 
-  Bitstream bitstream;
+  // blocks left with nonzero coefficients after the QDCT
+  std::uint32_t nonzero_mask = 0;
+
+  // entropy coded residual, a span of Frame::mb_bitstream
+  std::size_t bitstream_offset = 0;
+  int bitstream_bits = 0;
 
   static const std::array<int, 16> convert_table;
 
   MacroBlock(const int r, const int c): mb_row(r), mb_col(c) {}
 
+  void set_coded_block_pattern();
+
   Block4x4 get_Y_4x4_block(int pos);
   Block4x4 get_Cr_4x4_block(int pos);
   Block4x4 get_Cb_4x4_block(int pos);
 
-  Block4x4 get_Y_DC_block();
-  Block4x4 get_Y_AC_block(int pos);
+  LumaDCBlock get_Y_DC_block();
+  ACBlock4x4 get_Y_AC_block(int pos);
 
   Block2x2 get_Cr_DC_block();
-  Block4x4 get_Cr_AC_block(int pos);
+  ACBlock4x4 get_Cr_AC_block(int pos);
 
   Block2x2 get_Cb_DC_block();
-  Block4x4 get_Cb_AC_block(int pos);
+  ACBlock4x4 get_Cb_AC_block(int pos);
 };
 
+static_assert(std::is_trivially_copyable<MacroBlock>::value, "MacroBlock is copied around during encoding");
+
 #endif
@@ -0,0 +1,59 @@
+#ifndef MP4
+#define MP4
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "muxer.h"
+
+/* Big-endian box builder for ISO BMFF
+ * open() starts a box, close() patches its size
+ */
+class BoxWriter {
+public:
+  std::vector<std::uint8_t> buffer;
+
+  void u8(const std::uint8_t);
+  void u16(const std::uint16_t);
+  void u24(const std::uint32_t);
+  void u32(const std::uint32_t);
+  void u64(const std::uint64_t);
+  void fourcc(const char*);
+  void bytes(const std::uint8_t*, const std::size_t);
+  void zeros(const std::size_t);
+
+  void open(const char*);
+  void open_full(const char*, const std::uint8_t, const std::uint32_t);
+  void close();
+
+private:
+  std::vector<std::size_t> boxes;
+};
+
+/* Fragmented MP4
+ *
+ * ftyp and moov (with avcC and empty sample tables) are written up front,
+ * every batch of frames then becomes one moof + mdat fragment, so the file
+ * can be streamed. Samples are length prefixed, the start code of each
+ * NAL unit is skipped rather than rewritten.
+ */
+class MP4Muxer : public Muxer {
+public:
+  MP4Muxer(std::unique_ptr<Sink>, const int);
+
+  void write_header(const Bitstream&, const Bitstream&, const int, const int) override;
+  void write_samples(const std::vector<const Bitstream*>&) override;
+
+private:
+  std::unique_ptr<Sink> sink;
+  std::uint32_t timescale;
+  std::uint32_t sample_duration;
+  std::uint32_t sequence_number;
+  std::uint64_t decode_time;
+
+  void write_avcc(BoxWriter&, const Bitstream&, const Bitstream&);
+};
+
+#endif // MP4
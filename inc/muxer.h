@@ -0,0 +1,41 @@
+#ifndef MUXER
+#define MUXER
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "bitstream.h"
+#include "sink.h"
+
+/* Container format of the encoded video
+ *
+ * The Writer hands over complete NAL units in Annex B form (start code,
+ * NAL header and EBSP). write_samples() gets one NAL unit per frame, in
+ * decoding order, and is called once per batch of frames.
+ */
+class Muxer {
+public:
+  virtual ~Muxer() {}
+
+  virtual void write_header(const Bitstream&, const Bitstream&, const int, const int) = 0;
+  virtual void write_samples(const std::vector<const Bitstream*>&) = 0;
+};
+
+/* Raw H.264 elementary stream
+ * NAL units are written out as they are
+ */
+class AnnexBMuxer : public Muxer {
+public:
+  AnnexBMuxer(std::unique_ptr<Sink>);
+
+  void write_header(const Bitstream&, const Bitstream&, const int, const int) override;
+  void write_samples(const std::vector<const Bitstream*>&) override;
+
+private:
+  std::unique_ptr<Sink> sink;
+};
+
+std::unique_ptr<Muxer> open_muxer(const std::string&, const std::string&, const int, const int = 0);
+
+#endif // MUXER
@@ -35,18 +35,27 @@ enum class NALRefIdc {
  DISPOSABLE  = 0
 };
 
+/* NAL unit in byte stream format
+ *
+ * buffer holds the start code and the NAL header followed by the RBSP,
+ * so the payload can be written straight into it and sent out as is.
+ */
 class NALUnit {
 public:
+  static const std::size_t header_size = 5;
+  static std::uint8_t start_code[4];
+
   Bitstream buffer;
 
-  NALUnit(const NALRefIdc, const NALType, const Bitstream&);
+  NALUnit(const NALRefIdc, const NALType, const std::size_t = 0);
   std::uint8_t nal_header();
-  Bitstream get();
+  const Bitstream& get();
 
 private:
   int forbidden_zero_bit; // Always be zero
   NALRefIdc nal_ref_idc;
   NALType nal_unit_type;
+  bool is_ebsp;
 };
 
 #endif
\ No newline at end of file
@@ -36,21 +36,29 @@ void inverse_hadamard4x4(const int[][4], int[][4]);
 void forward_hadamard2x2(const int[][2], int[][2]);
 void inverse_hadamard2x2(const int[][2], int[][2]);
 
+/* Nonzero mask returned by the forward QDCT
+ *
+ * bit n is set if the n-th 4x4 block (raster order) has a nonzero AC
+ * coefficient, QDCT_DC_NONZERO if any DC coefficient is nonzero. The
+ * inverse QDCT takes it back to skip the empty blocks.
+ */
+const int QDCT_DC_NONZERO = 1 << 16;
+
 // Main QDCT function used as an expandable funciton
 template <typename T>
-inline void forward_qdct(T&, const int, const int);
+inline int forward_qdct(T&, const int, const int);
 template <typename T>
-inline void inverse_qdct(T&, const int, const int);
+inline void inverse_qdct(T&, const int, const int, const int);
 
-inline void forward_qdct4x4(Block4x4, const int);
+inline bool forward_qdct4x4(Block4x4, const int);
 inline void inverse_qdct4x4(Block4x4, const int);
 
 // Public interface
-void qdct_luma16x16_intra(Block16x16&);
-void qdct_chroma8x8_intra(Block8x8&);
-void qdct_luma4x4_intra(Block4x4);
-void inv_qdct_luma16x16_intra(Block16x16&);
-void inv_qdct_chroma8x8_intra(Block8x8&);
+int qdct_luma16x16_intra(Block16x16&);
+int qdct_chroma8x8_intra(Block8x8&);
+bool qdct_luma4x4_intra(Block4x4);
+void inv_qdct_luma16x16_intra(Block16x16&, const int);
+void inv_qdct_chroma8x8_intra(Block8x8&, const int);
 void inv_qdct_luma4x4_intra(Block4x4);
 
 #endif // QDCT
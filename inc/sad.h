@@ -0,0 +1,45 @@
+#ifndef SAD
+#define SAD
+
+//#define EN_SCALAR_SAD     // always use the scalar SAD / SATD
+//#define EN_DBG_SAD_SIMD   // check the SIMD SAD / SATD against the scalar ones
+
+/* Sum of absolute differences of two contiguous sample arrays
+ * of 16 (4x4), 64 (8x8) or 256 (16x16) ints
+ *
+ * Only the cost of a candidate, the residual of the winning mode is
+ * computed afterwards by get_residual().
+ */
+int sad4x4(const int*, const int*);
+int sad8x8(const int*, const int*);
+int sad16x16(const int*, const int*);
+
+/* Sum of absolute transformed differences
+ * the 4x4 Hadamard transform of the difference, halved, summed over
+ * all 4x4 blocks. Follows the bits after the integer transform much
+ * closer than the SAD, at about twice the cost.
+ */
+int satd4x4(const int*, const int*);
+int satd8x8(const int*, const int*);
+int satd16x16(const int*, const int*);
+
+/* Cost metric of the intra mode decision
+ * set once from the command line, SAD by default
+ * RATE_DISTORTION is decided in frame_encode, the mode_cost functions
+ * fall back to the SAD for it
+ */
+enum class CostMetric { ABS_DIFF, HADAMARD, RATE_DISTORTION };  // SAD, SATD, SSD + lambda * bits
+
+class ModeCost {
+public:
+  static CostMetric metric;
+};
+
+int mode_cost4x4(const int*, const int*);
+int mode_cost8x8(const int*, const int*);
+int mode_cost16x16(const int*, const int*);
+
+void get_residual(int*, const int*, const int*, const int);
+void get_reconstruction(int*, const int*, const int, const int);
+
+#endif // SAD
@@ -0,0 +1,80 @@
+#ifndef SINK
+#define SINK
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sys/uio.h>
+
+#include "log.h"
+
+/* Output sink of the encoded byte stream
+ *
+ * write() takes a list of byte ranges, so that several NAL units can be
+ * handed over in one call without concatenating them first.
+ */
+class Sink {
+public:
+  virtual ~Sink() {}
+
+  virtual void write(const struct iovec*, const int) = 0;
+  virtual void flush() {}
+
+  void write(const std::uint8_t*, const std::size_t);
+};
+
+/* File descriptor sink
+ * regular file, stdout or a pipe, written with writev(2)
+ */
+class FileSink : public Sink {
+public:
+  FileSink(const std::string&);
+  ~FileSink();
+
+  void write(const struct iovec*, const int) override;
+  using Sink::write;
+
+protected:
+  Log logger;
+  int fd;
+
+  FileSink(const int);
+};
+
+/* Write to stdout
+ *
+ * The encoded stream takes over stdout, anything else printed
+ * to stdout is redirected to stderr.
+ */
+class StdoutSink : public FileSink {
+public:
+  StdoutSink();
+};
+
+/* Write into the stdin of a shell command
+ * e.g. a muxer or an uploader
+ */
+class PipeSink : public FileSink {
+public:
+  PipeSink(const std::string&);
+  ~PipeSink();
+
+private:
+  FILE* pipe;
+};
+
+/* Growable in-memory buffer
+ */
+class MemorySink : public Sink {
+public:
+  std::vector<std::uint8_t> buffer;
+
+  void write(const struct iovec*, const int) override;
+  using Sink::write;
+};
+
+std::unique_ptr<Sink> open_sink(const std::string&);
+
+#endif // SINK
@@ -0,0 +1,62 @@
+#ifndef TS
+#define TS
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "log.h"
+#include "muxer.h"
+
+/* MPEG-2 transport stream
+ *
+ * One program with a single H.264 stream. Every frame becomes one PES
+ * packet led by an access unit delimiter, PAT/PMT are repeated in front
+ * of every batch of frames.
+ *
+ * With segment_frames > 0 the stream is cut into separate .ts files of
+ * that many frames, each starting with PAT/PMT and SPS/PPS, and an HLS
+ * playlist is kept up to date next to them:
+ *   name "video/out.m3u8" gives video/out0.ts, video/out1.ts, ...
+ *   and the playlist video/out.m3u8
+ */
+class TSMuxer : public Muxer {
+public:
+  static const int packet_size = 188;
+  static const int video_pid = 0x100;
+  static const int pmt_pid = 0x1000;
+
+  TSMuxer(const std::string&, const int, const int);
+  ~TSMuxer();
+
+  void write_header(const Bitstream&, const Bitstream&, const int, const int) override;
+  void write_samples(const std::vector<const Bitstream*>&) override;
+
+private:
+  Log logger;
+  std::string name;
+  std::string stem;
+  int fps;
+  int segment_frames;
+
+  std::unique_ptr<Sink> sink;
+  std::vector<std::uint8_t> packets;
+  Bitstream sps;
+  Bitstream pps;
+  std::uint8_t continuity[3];  // PAT, PMT, video
+  std::uint64_t nb_frames;
+  int segment_nb_frames;
+  std::vector<int> segments;  // frames in each finished segment
+
+  std::string segment_name(const std::size_t);
+  void open_segment();
+  void close_segment();
+  void write_playlist(const bool);
+
+  void write_psi(const int, std::uint8_t&, const std::vector<std::uint8_t>&);
+  void write_pat_pmt();
+  void write_pes(const Bitstream&, const bool);
+};
+
+#endif // TS
@@ -11,7 +11,10 @@ class Util {
 public:
   unsigned int width, height;
   int test_frame;
-  std::string input_file, output_file;
+  int fps;
+  int segment_frames;
+  bool cabac;
+  std::string input_file, output_file, output_format;
 
   Util(const int, const char*[]);
 
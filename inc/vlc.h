@@ -9,6 +9,9 @@
 #include "block.h"
 #include "bitstream.h"
 
+//#define EN_SCALAR_CAVLC     // always use the scalar zigzag scan
+//#define EN_DBG_CAVLC_SIMD   // check the SIMD zigzag scan against the scalar one
+
 const int me[] = {
 	3 , 29, 30, 17, 31,
 	18, 37, 8 , 32, 38, 
@@ -22,10 +25,46 @@ const int me[] = {
 	14, 15, 0
 };
 
+/* Codeword of a table driven VLC
+ * the lowest nb_bits of code, MSB first
+ */
+struct VLCCode {
+  std::uint32_t code;
+  int nb_bits;
+};
+
+/* Zigzag scanned 4x4 (or 2x2) block
+ *   nonzero  bit i set if coeff[i] is nonzero
+ *   ones     bit i set if coeff[i] is 1 or -1
+ */
+struct ScannedBlock {
+  int coeff[16];
+  std::uint32_t nonzero;
+  std::uint32_t ones;
+};
+
 Bitstream ue(const unsigned int);
 Bitstream se(const int);
+int ue_bits(const unsigned int);
+int se_bits(const int);
+
+void scan_coeffs(Block4x4, ScannedBlock&);
+void scan_coeffs(ACBlock4x4, ScannedBlock&);
+void scan_coeffs(LumaDCBlock, ScannedBlock&);
+void scan_coeffs(Block2x2, ScannedBlock&);
 
+Bitstream cavlc_empty_block(const int);
 std::pair<Bitstream, int> cavlc_block2x2(Block2x2, const int, const int);
 std::pair<Bitstream, int> cavlc_block4x4(Block4x4, const int, const int);
+std::pair<Bitstream, int> cavlc_block4x4(ACBlock4x4, const int, const int);
+std::pair<Bitstream, int> cavlc_block4x4(LumaDCBlock, const int, const int);
+
+// bit cost only, no Bitstream is built
+int cavlc_bits_empty_block(const int);
+int cavlc_bits_block2x2(Block2x2, const int, const int);
+int cavlc_bits_block4x4(Block4x4, const int, const int);
+int cavlc_bits_block4x4(ACBlock4x4, const int, const int);
+int cavlc_bits_block4x4(LumaDCBlock, const int, const int);
+int cavlc_bits_block4x4(const ScannedBlock&, const int, const int);
 
 #endif
@@ -54,11 +54,16 @@ class Worker_encode_one_frame {
     public:
       int threadId;
       Frame* frame;
+      Writer* writer;
+      int frame_num;
+      Bitstream slice;  // packaged NAL unit, ready to be written
 
-      Worker_encode_one_frame(const int id, Frame* frame)
+      Worker_encode_one_frame(const int id, Frame* frame, Writer* writer, const int frame_num)
       {
         this->threadId = id;
         this->frame = frame;
+        this->writer = writer;
+        this->frame_num = frame_num;
       };
 };
 
@@ -67,7 +72,7 @@ class Worker_Y_intra4x4_modes {
       int threadId;
       int predict_mode_start;
       int predict_mode_end;
-      Predictor* predictor;
+      const Predictor* predictor;
       Block4x4* block;
 
       Worker_Y_intra4x4_modes() {};
@@ -78,7 +83,7 @@ class Worker_Y_intra16x16_modes {
       int threadId;
       int predict_mode_start;
       int predict_mode_end;
-      Predictor* predictor;
+      const Predictor* predictor;
       Block16x16* block;
 
       Worker_Y_intra16x16_modes() {};
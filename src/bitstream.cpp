@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstring>
 #include "bitstream.h"
 
 Bitstream::Bitstream(): nb_bits(0) {}
@@ -26,6 +27,10 @@ Bitstream::Bitstream(const Bitstream& a) {
   buffer.insert(buffer.end(), a.buffer.begin(), a.buffer.end());
 }
 
+Bitstream::Bitstream(Bitstream&& a) noexcept: nb_bits(a.nb_bits), buffer(std::move(a.buffer)) {
+  a.nb_bits = 0;
+}
+
 Bitstream::Bitstream(const std::string& s) {
   nb_bits = s.size();
   int nb_int = nb_bits % 8 == 0 ? nb_bits/8: nb_bits/8 + 1;
@@ -58,11 +63,33 @@ Bitstream::Bitstream(const unsigned int cui, int digit) {
     buffer.push_back((std::uint8_t)(ui));
 }
 
+Bitstream& Bitstream::operator=(const Bitstream& a) {
+  nb_bits = a.nb_bits;
+  buffer = a.buffer;
+  return *this;
+}
+
+Bitstream& Bitstream::operator=(Bitstream&& a) noexcept {
+  nb_bits = a.nb_bits;
+  buffer = std::move(a.buffer);
+  a.nb_bits = 0;
+  return *this;
+}
+
 Bitstream& Bitstream::operator+=(const Bitstream& a) {
+  return append(a.buffer.data(), a.nb_bits);
+}
+
+/* Append the first nb_append bits of a raw byte array
+ */
+Bitstream& Bitstream::append(const std::uint8_t* bits, const int nb_append) {
+  if (nb_append == 0)
+    return *this;
+
   int trail_bits = this->nb_bits % 8;
 
   if (trail_bits == 0) {
-    this->buffer.insert(this->buffer.end(), a.buffer.begin(), a.buffer.end());
+    this->buffer.insert(this->buffer.end(), bits, bits + (nb_append + 7) / 8);
   }
   else {
     std::uint8_t tmp = this->buffer.back();
@@ -71,8 +98,8 @@ Bitstream& Bitstream::operator+=(const Bitstream& a) {
     // clear tmp
     tmp &= (0b11111111 << (8 - trail_bits));
 
-    int last_bits = a.nb_bits;
-    auto itr = a.buffer.begin();
+    int last_bits = nb_append;
+    const std::uint8_t* itr = bits;
 
     while (last_bits >= 8) {
       tmp |= *itr >> trail_bits;
@@ -82,69 +109,120 @@ Bitstream& Bitstream::operator+=(const Bitstream& a) {
       itr++;
     }
 
-    tmp |= *itr >> trail_bits;
-    this->buffer.push_back(tmp);
+    if (last_bits > 0) {
+      tmp |= *itr >> trail_bits;
+      this->buffer.push_back(tmp);
 
-    if (last_bits > (8 - trail_bits)) {
-      tmp = *itr << (8 - trail_bits);
+      if (last_bits > (8 - trail_bits)) {
+        tmp = *itr << (8 - trail_bits);
+        this->buffer.push_back(tmp);
+      }
+    }
+    else {
       this->buffer.push_back(tmp);
     }
   }
 
-  this->nb_bits += a.nb_bits;
+  this->nb_bits += nb_append;
   return *this;
 }
 
-Bitstream Bitstream::operator+(const Bitstream& a) {
-  Bitstream c(*this);
-  int trail_bits = c.nb_bits % 8;
-
-  if (trail_bits == 0) {
-    c.buffer.insert(c.buffer.end(), a.buffer.begin(), a.buffer.end());
-  }
-  else {
-    std::uint8_t tmp = c.buffer.back();
-    c.buffer.pop_back();
-
-    // clear tmp
-    tmp &= (0b11111111 << (8 - trail_bits));
+/* Append a temporary
+ * an empty stream just takes over the buffer of a instead of copying it
+ */
+Bitstream& Bitstream::operator+=(Bitstream&& a) {
+  if (this->nb_bits == 0 && this->buffer.capacity() < a.buffer.size())
+    return *this = std::move(a);
+  return *this += static_cast<const Bitstream&>(a);
+}
 
-    int last_bits = a.nb_bits;
-    auto itr = a.buffer.begin();
+Bitstream Bitstream::operator+(const Bitstream& a) const {
+  Bitstream c;
+  c.reserve(this->buffer.size() + a.buffer.size());
+  c += *this;
+  c += a;
+  return c;
+}
 
-    while (last_bits >= 8) {
-      tmp |= *itr >> trail_bits;
-      c.buffer.push_back(tmp);
-      tmp = *itr << (8 - trail_bits);
-      last_bits -= 8;
-      itr++;
-    }
+/* Append raw bytes to a byte-aligned stream
+ * in one bulk copy, e.g. the samples of an I_PCM macroblock
+ */
+Bitstream& Bitstream::append_aligned(const std::uint8_t* bytes, const std::size_t nb_bytes) {
+  assert(nb_bits % 8 == 0);
 
-    tmp |= *itr >> trail_bits;
-    c.buffer.push_back(tmp);
+  buffer.insert(buffer.end(), bytes, bytes + nb_bytes);
+  nb_bits += nb_bytes * 8;
+  return *this;
+}
 
-    if (last_bits > (8 - trail_bits)) {
-      tmp = *itr << (8 - trail_bits);
-      c.buffer.push_back(tmp);
-    }
+/* Append the lowest nb_put bits of code, MSB first
+ * nb_put is at most 32, used by the table driven VLC writers
+ */
+Bitstream& Bitstream::put(const std::uint32_t code, const int nb_put) {
+  if (nb_put == 0)
+    return *this;
+
+  int used = nb_bits % 8;
+  int left = used + nb_put;
+  std::uint64_t bits = (static_cast<std::uint64_t>(code) << (64 - nb_put)) >> used;
+
+  if (used != 0) {
+    buffer.back() = (buffer.back() & (0xff << (8 - used))) | (bits >> 56);
+    bits <<= 8;
+    left -= 8;
+  }
+  for (; left > 0; left -= 8) {
+    buffer.push_back(bits >> 56);
+    bits <<= 8;
   }
 
-  c.nb_bits += a.nb_bits;
-  return c;
+  nb_bits += nb_put;
+  return *this;
+}
+
+/* Reserve capacity in bytes
+ * so that the following appends do not reallocate
+ */
+void Bitstream::reserve(const std::size_t nb_bytes) {
+  buffer.reserve(nb_bytes);
 }
 
 bool Bitstream::byte_align() {
   return (nb_bits % 8 == 0) ? true : false;
 }
 
-Bitstream Bitstream::rbsp_trailing_bits() {
+/* Append rbsp_stop_one_bit and rbsp_alignment_zero_bits in place
+ */
+Bitstream& Bitstream::rbsp_trailing_bits() {
   // rbsp_stop_one_bit
-  Bitstream rbsp = (*this) + Bitstream(static_cast<std::uint8_t>(1), 1);
-  int trail_bits = rbsp.nb_bits % 8;
+  (*this) += Bitstream(static_cast<std::uint8_t>(1), 1);
+  int trail_bits = nb_bits % 8;
   // rbsp_trailing_bits
   if (trail_bits != 0)
-    rbsp += Bitstream(static_cast<std::uint8_t>(0), (8-trail_bits));
-  return rbsp;
+    (*this) += Bitstream(static_cast<std::uint8_t>(0), (8-trail_bits));
+  return *this;
+}
+
+/* Find the next byte which needs an emulation_prevention_three_byte
+ * in front of it, i.e. a byte <= 0x03 behind two 0x00 bytes
+ *
+ * memchr jumps over the non-zero stretches, so only the zero bytes
+ * are looked at one by one. Return end if there is none.
+ */
+static const std::uint8_t* next_escape(const std::uint8_t* p, const std::uint8_t* end) {
+  while (end - p >= 3) {
+    p = static_cast<const std::uint8_t*>(std::memchr(p, 0x00, end - p - 2));
+    if (p == nullptr)
+      return end;
+
+    if (p[1] != 0x00)
+      p += 2;
+    else if (p[2] <= 0x03)
+      return p + 2;
+    else
+      p += 3;
+  }
+  return end;
 }
 
 /* This function add emulation_prevention_three_byte for all occurrences
@@ -153,33 +231,44 @@ Bitstream Bitstream::rbsp_trailing_bits() {
  *  0x000001  -> 0x00000301
  *  0x000002  -> 0x00000302
  *  0x000003  -> 0x00000303
+ *
+ * It works in place on the bytes from begin onwards, so that a start code
+ * and NAL header written in front of the RBSP are left untouched. The first
+ * pass counts the escapes to grow the buffer exactly once, the second pass
+ * moves the payload to the back and copies the clean stretches forward.
  */
-Bitstream Bitstream::rbsp_to_ebsp() {
-  
-  assert(nb_bits % 8 == 0);
+Bitstream& Bitstream::rbsp_to_ebsp(const std::size_t begin) {
 
-  // output: ebsp
-  Bitstream ebsp;
-  int count = 0;
+  assert(nb_bits % 8 == 0);
 
-  for (const auto& byte : buffer) {
-    // Detect 0x00 twice
-    if (count == 2 && !(byte & 0xfc)) {
-      ebsp.buffer.push_back(0x03);
-      ebsp.nb_bits += 8;
-      count = 0;
-    }
-    ebsp.buffer.push_back(byte);
-    ebsp.nb_bits += 8;
-    if (byte == 0x00) {
-      count++;
-    }
-    else {
-      count = 0;
-    }
+  std::size_t size = buffer.size();
+  std::size_t nb_inserts = 0;
+  const std::uint8_t* end = buffer.data() + size;
+  for (const std::uint8_t* p = next_escape(buffer.data() + begin, end); p != end; p = next_escape(p, end))
+    nb_inserts++;
+
+  if (nb_inserts == 0)
+    return *this;
+
+  buffer.resize(size + nb_inserts);
+  std::uint8_t* data = buffer.data();
+  std::memmove(data + begin + nb_inserts, data + begin, size - begin);
+
+  // source is always ahead of destination by the escapes still to come
+  const std::uint8_t* src = data + begin + nb_inserts;
+  const std::uint8_t* src_end = data + size + nb_inserts;
+  std::uint8_t* dst = data + begin;
+  while (src != src_end) {
+    const std::uint8_t* esc = next_escape(src, src_end);
+    std::memmove(dst, src, esc - src);
+    dst += esc - src;
+    src = esc;
+    if (esc != src_end)
+      *dst++ = 0x03;
   }
 
-  return ebsp;
+  nb_bits += nb_inserts * 8;
+  return *this;
 }
 
 std::string Bitstream::to_string() {
@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "cabac.h"
+
+/* rangeTabLPS[ pStateIdx ][ qCodIRangeIdx ]
+ */
+static const std::uint8_t range_lps[64][4] = {
+  {128, 176, 208, 240}, {128, 167, 197, 227}, {128, 158, 187, 216}, {123, 150, 178, 205},
+  {116, 142, 169, 195}, {111, 135, 160, 185}, {105, 128, 152, 175}, {100, 122, 144, 166},
+  {95, 116, 137, 158}, {90, 110, 130, 150}, {85, 104, 123, 142}, {81, 99, 117, 135},
+  {77, 94, 111, 128}, {73, 89, 105, 122}, {69, 85, 100, 116}, {66, 80, 95, 110},
+  {62, 76, 90, 104}, {59, 72, 86, 99}, {56, 69, 81, 94}, {53, 65, 77, 89},
+  {51, 62, 73, 85}, {48, 59, 69, 80}, {46, 56, 66, 76}, {43, 53, 63, 72},
+  {41, 50, 59, 69}, {39, 48, 56, 65}, {37, 45, 54, 62}, {35, 43, 51, 59},
+  {33, 41, 48, 56}, {32, 39, 46, 53}, {30, 37, 43, 50}, {29, 35, 41, 48},
+  {27, 33, 39, 45}, {26, 31, 37, 43}, {24, 30, 35, 41}, {23, 28, 33, 39},
+  {22, 27, 32, 37}, {21, 26, 30, 35}, {20, 24, 29, 33}, {19, 23, 27, 31},
+  {18, 22, 26, 30}, {17, 21, 25, 28}, {16, 20, 23, 27}, {15, 19, 22, 25},
+  {14, 18, 21, 24}, {14, 17, 20, 23}, {13, 16, 19, 22}, {12, 15, 18, 21},
+  {12, 14, 17, 20}, {11, 14, 16, 19}, {11, 13, 15, 18}, {10, 12, 15, 17},
+  {10, 12, 14, 16}, {9, 11, 13, 15}, {9, 11, 12, 14}, {8, 10, 12, 14},
+  {8, 9, 11, 13}, {7, 9, 11, 12}, {7, 9, 10, 12}, {7, 8, 10, 11},
+  {6, 8, 9, 11}, {6, 7, 9, 10}, {6, 7, 8, 9}, {2, 2, 2, 2}
+};
+
+/* transIdxLPS[ pStateIdx ]
+ */
+static const std::uint8_t trans_idx_lps[64] = {
+  0, 0, 1, 2, 2, 4, 4, 5, 6, 7, 8, 9, 9, 11, 11, 12,
+  13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+  24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+  33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63
+};
+
+/* Initialization values (m, n) of the contexts in I slices
+ */
+static const std::int8_t context_init_I[CABAC_NB_CTX][2] = {
+  // 0 - 10 mb_type
+  {20, -15}, {2, 54}, {3, 74}, {20, -15},
+  {2, 54}, {3, 74}, {-28, 127}, {-23, 104},
+  {-6, 53}, {-1, 54}, {7, 51},
+  // 11 - 59 are not used in I slices
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+  // 60 - 69 mb_qp_delta, intra_chroma_pred_mode, intra 4x4 pred modes
+  {0, 41}, {0, 63}, {0, 63}, {0, 63},
+  {-9, 83}, {4, 86}, {0, 97}, {-7, 72},
+  {13, 41}, {3, 62},
+  // 70 - 104 mb_field_decoding_flag, coded_block_pattern, coded_block_flag
+  {0, 11}, {1, 55}, {0, 69}, {-17, 127},
+  {-13, 102}, {0, 82}, {-7, 74}, {-21, 107},
+  {-27, 127}, {-31, 127}, {-24, 127}, {-18, 95},
+  {-27, 127}, {-21, 114}, {-30, 127}, {-17, 123},
+  {-12, 115}, {-16, 122}, {-11, 115}, {-12, 63},
+  {-2, 68}, {-15, 84}, {-13, 104}, {-3, 70},
+  {-8, 93}, {-10, 90}, {-30, 127}, {-1, 74},
+  {-6, 97}, {-7, 91}, {-20, 127}, {-4, 56},
+  {-5, 82}, {-7, 76}, {-22, 125},
+  // 105 - 165 significant_coeff_flag
+  {-7, 93}, {-11, 87}, {-3, 77}, {-5, 71},
+  {-4, 63}, {-4, 68}, {-12, 84}, {-7, 62},
+  {-7, 65}, {8, 61}, {5, 56}, {-2, 66},
+  {1, 64}, {0, 61}, {-2, 78}, {1, 50},
+  {7, 52}, {10, 35}, {0, 44}, {11, 38},
+  {1, 45}, {0, 46}, {5, 44}, {31, 17},
+  {1, 51}, {7, 50}, {28, 19}, {16, 33},
+  {14, 62}, {-13, 108}, {-15, 100}, {-13, 101},
+  {-13, 91}, {-12, 94}, {-10, 88}, {-16, 84},
+  {-10, 86}, {-7, 83}, {-13, 87}, {-19, 94},
+  {1, 70}, {0, 72}, {-5, 74}, {18, 59},
+  {-8, 102}, {-15, 100}, {0, 95}, {-4, 75},
+  {2, 72}, {-11, 75}, {-3, 71}, {15, 46},
+  {-13, 69}, {0, 62}, {0, 65}, {21, 37},
+  {-15, 72}, {9, 57}, {16, 54}, {0, 62},
+  {12, 72},
+  // 166 - 226 last_significant_coeff_flag
+  {24, 0}, {15, 9}, {8, 25}, {13, 18},
+  {15, 9}, {13, 19}, {10, 37}, {12, 18},
+  {6, 29}, {20, 33}, {15, 30}, {4, 45},
+  {1, 58}, {0, 62}, {7, 61}, {12, 38},
+  {11, 45}, {15, 39}, {11, 42}, {13, 44},
+  {16, 45}, {12, 41}, {10, 49}, {30, 34},
+  {18, 42}, {10, 55}, {17, 51}, {17, 46},
+  {0, 89}, {26, -19}, {22, -17}, {26, -17},
+  {30, -25}, {28, -20}, {33, -23}, {37, -27},
+  {33, -23}, {40, -28}, {38, -17}, {33, -11},
+  {40, -15}, {41, -6}, {38, 1}, {41, 17},
+  {30, -6}, {27, 3}, {26, 22}, {37, -16},
+  {35, -4}, {38, -8}, {38, -3}, {37, 3},
+  {38, 5}, {42, 0}, {35, 16}, {39, 22},
+  {14, 48}, {27, 37}, {21, 60}, {12, 68},
+  {2, 97},
+  // 227 - 275 coeff_abs_level_minus1
+  {-3, 71}, {-6, 42}, {-5, 50}, {-3, 54},
+  {-2, 62}, {0, 58}, {1, 63}, {-2, 72},
+  {-1, 74}, {-9, 91}, {-5, 67}, {-5, 27},
+  {-3, 39}, {-2, 44}, {0, 46}, {-16, 64},
+  {-8, 68}, {-10, 78}, {-6, 77}, {-10, 86},
+  {-12, 92}, {-15, 55}, {-10, 60}, {-6, 62},
+  {-4, 65}, {-12, 73}, {-8, 76}, {-7, 80},
+  {-9, 88}, {-17, 110}, {-11, 97}, {-20, 84},
+  {-11, 79}, {-6, 73}, {-4, 74}, {-13, 86},
+  {-13, 96}, {-11, 97}, {-19, 117}, {-8, 78},
+  {-5, 33}, {-4, 48}, {-2, 53}, {-3, 62},
+  {-13, 71}, {-10, 79}, {-12, 86}, {-13, 90},
+  {-14, 97},
+};
+
+/* Next context after coding the MPS or the LPS
+ * indexed by the context byte, pStateIdx << 1 | valMPS
+ */
+static std::uint8_t next_state_mps[128];
+static std::uint8_t next_state_lps[128];
+
+static bool init_transition_tables() {
+  for (int state = 0; state != 64; state++) {
+    for (int mps = 0; mps != 2; mps++) {
+      int ctx = (state << 1) | mps;
+      next_state_mps[ctx] = (std::min(state + 1, 62) << 1) | mps;
+      if (state == 62 || state == 63)
+        next_state_mps[ctx] = ctx;
+      next_state_lps[ctx] = (trans_idx_lps[state] << 1) | (state == 0 ? 1 - mps : mps);
+    }
+  }
+  return true;
+}
+
+static const bool transition_tables_ready = init_transition_tables();
+
+CABACEncoder::CABACEncoder(Bitstream& _bitstream): bitstream(_bitstream) {
+  pending = 0;
+  nb_pending = 0;
+  init_engine();
+}
+
+/* Initialize all contexts for SliceQPY
+ */
+void CABACEncoder::init_contexts(const int slice_qp) {
+  const int qp = std::max(0, std::min(51, slice_qp));
+  for (int i = 0; i != CABAC_NB_CTX; i++) {
+    int state = std::max(1, std::min(126, ((context_init_I[i][0] * qp) >> 4) + context_init_I[i][1]));
+    contexts[i] = (state <= 63) ? (63 - state) << 1 : ((state - 64) << 1) | 1;
+  }
+}
+
+/* Start the arithmetic coder
+ * at the beginning of the slice data and after the PCM samples
+ */
+void CABACEncoder::init_engine() {
+  low = 0;
+  range = 510;
+  outstanding = 0;
+  first_bit = true;
+}
+
+void CABACEncoder::write_bits(const std::uint32_t code, const int nb_bits) {
+  if (nb_pending + nb_bits > 32) {
+    bitstream.put(pending, nb_pending);
+    pending = 0;
+    nb_pending = 0;
+  }
+  pending = (pending << nb_bits) | code;
+  nb_pending += nb_bits;
+}
+
+/* PutBit, followed by the outstanding bits of the opposite value
+ */
+void CABACEncoder::put_bit(const int bit) {
+  if (first_bit)
+    first_bit = false;
+  else
+    write_bits(bit, 1);
+
+  while (outstanding > 0) {
+    int n = std::min(outstanding, 16);
+    write_bits(bit ? 0 : (1 << n) - 1, n);
+    outstanding -= n;
+  }
+}
+
+void CABACEncoder::renorm() {
+  while (range < 256) {
+    if (low < 256) {
+      put_bit(0);
+    } else if (low >= 512) {
+      low -= 512;
+      put_bit(1);
+    } else {
+      low -= 256;
+      outstanding++;
+    }
+    range <<= 1;
+    low <<= 1;
+  }
+}
+
+void CABACEncoder::encode_decision(const int ctx_idx, const int bin) {
+  std::uint8_t& ctx = contexts[ctx_idx];
+  std::uint32_t range_lps_value = range_lps[ctx >> 1][(range >> 6) & 3];
+  range -= range_lps_value;
+
+  if (bin != (ctx & 1)) {
+    low += range;
+    range = range_lps_value;
+    ctx = next_state_lps[ctx];
+  } else {
+    ctx = next_state_mps[ctx];
+  }
+
+  if (range < 256)
+    renorm();
+}
+
+void CABACEncoder::encode_bypass(const int bin) {
+  low <<= 1;
+  if (bin)
+    low += range;
+
+  if (low >= 1024) {
+    put_bit(1);
+    low -= 1024;
+  } else if (low < 512) {
+    put_bit(0);
+  } else {
+    low -= 512;
+    outstanding++;
+  }
+}
+
+/* end_of_slice_flag and the I_PCM bin of mb_type
+ * a 1 flushes the coder, the last bit written is the rbsp_stop_one_bit
+ */
+void CABACEncoder::encode_terminate(const int bin) {
+  range -= 2;
+  if (bin) {
+    low += range;
+    flush();
+  } else if (range < 256) {
+    renorm();
+  }
+}
+
+void CABACEncoder::flush() {
+  range = 2;
+  renorm();
+  put_bit((low >> 9) & 1);
+  write_bits(((low >> 7) & 3) | 1, 2);
+
+  bitstream.put(pending, nb_pending);
+  pending = 0;
+  nb_pending = 0;
+}
+
+/* UEG0 suffix of coeff_abs_level_minus1
+ */
+void CABACEncoder::encode_exp_golomb_bypass(int value) {
+  int k = 0;
+  while (value >= (1 << k)) {
+    encode_bypass(1);
+    value -= 1 << k;
+    k++;
+  }
+  encode_bypass(0);
+  while (k--)
+    encode_bypass((value >> k) & 1);
+}
+
+static const int cbf_offset[5] = {0, 4, 8, 12, 16};
+static const int significant_offset[5] = {0, 15, 29, 44, 47};
+static const int abs_level_offset[5] = {0, 10, 20, 30, 39};
+static const int max_nb_coeff[5] = {16, 15, 16, 4, 15};
+
+/* coded_block_flag of a block known to be empty
+ */
+void CABACEncoder::encode_empty_block(const BlockCat block_cat, const int cbf_inc) {
+  encode_decision(CTX_CODED_BLOCK_FLAG + cbf_offset[static_cast<int>(block_cat)] + cbf_inc, 0);
+}
+
+/* residual_block_cabac
+ *
+ * coded_block_flag with the given ctxIdxInc, then the significance map
+ * and the levels in reverse scan order. AC blocks start at scan
+ * position 1, the positions come from the nonzero bitmap.
+ */
+void CABACEncoder::encode_residual_block(const ScannedBlock& scan, const BlockCat block_cat, const int cbf_inc) {
+  const int cat = static_cast<int>(block_cat);
+  const int first = (block_cat == BlockCat::LUMA_AC || block_cat == BlockCat::CHROMA_AC) ? 1 : 0;
+  const int* coeff = scan.coeff + first;
+  const std::uint32_t nonzero = scan.nonzero >> first;
+
+  encode_decision(CTX_CODED_BLOCK_FLAG + cbf_offset[cat] + cbf_inc, nonzero != 0);
+  if (nonzero == 0)
+    return;
+
+  // significance map, the last coefficient of the block is inferred
+  const int last = 31 - __builtin_clz(nonzero);
+  const int significant_ctx = CTX_SIGNIFICANT_COEFF + significant_offset[cat];
+  const int last_ctx = CTX_LAST_SIGNIFICANT_COEFF + significant_offset[cat];
+  for (int i = 0; i != max_nb_coeff[cat] - 1; i++) {
+    int significant = (nonzero >> i) & 1;
+    encode_decision(significant_ctx + i, significant);
+    if (significant) {
+      encode_decision(last_ctx + i, i == last);
+      if (i == last)
+        break;
+    }
+  }
+
+  // levels, highest frequency first
+  const int level_ctx = CTX_COEFF_ABS_LEVEL + abs_level_offset[cat];
+  const int max_gt1_inc = (block_cat == BlockCat::CHROMA_DC) ? 3 : 4;
+  int nb_eq1 = 0;
+  int nb_gt1 = 0;
+  std::uint32_t levels = nonzero;
+  while (levels != 0) {
+    int i = 31 - __builtin_clz(levels);
+    levels &= ~(1u << i);
+
+    int abs_level_minus1 = std::abs(coeff[i]) - 1;
+    int ctx = level_ctx + ((nb_gt1 != 0) ? 0 : std::min(4, 1 + nb_eq1));
+    if (abs_level_minus1 == 0) {
+      encode_decision(ctx, 0);
+      nb_eq1++;
+    } else {
+      encode_decision(ctx, 1);
+      ctx = level_ctx + 5 + std::min(max_gt1_inc, nb_gt1);
+      int prefix = std::min(abs_level_minus1, 14);
+      for (int j = 1; j < prefix; j++)
+        encode_decision(ctx, 1);
+      if (abs_level_minus1 < 14)
+        encode_decision(ctx, 0);
+      else
+        encode_exp_golomb_bypass(abs_level_minus1 - 14);
+      nb_gt1++;
+    }
+
+    // coeff_sign_flag
+    encode_bypass(coeff[i] < 0);
+  }
+}
@@ -50,7 +50,7 @@ void deblock_Y_vertical(int cur_pos, MacroBlock& mb, std::vector<MacroBlock>& de
 
   int qPav = (LUMA_QP + LUMA_QP) >> 1;
   for (int i = 0; i != 4; i++)
-    filter_Y(bs, qPav, blockP[i * 4], blockP[i * 4 + 1], blockP[i * 4 + 2], blockP[i * 4 + 3], blockQ[i * 4], blockQ[i * 4 + 1], blockQ[i * 4 + 2], blockQ[i * 4 + 3]);
+    filter_Y(bs, qPav, blockP(i, 0), blockP(i, 1), blockP(i, 2), blockP(i, 3), blockQ(i, 0), blockQ(i, 1), blockQ(i, 2), blockQ(i, 3));
 }
 
 void deblock_Y_horizontal(int cur_pos, MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
@@ -86,7 +86,7 @@ void deblock_Y_horizontal(int cur_pos, MacroBlock& mb, std::vector<MacroBlock>&
 
   int qPav = (LUMA_QP + LUMA_QP) >> 1;
   for (int i = 0; i != 4; i++)
-    filter_Y(bs, qPav, blockP[i * 4], blockP[i * 4 + 1], blockP[i * 4 + 2], blockP[i * 4 + 3], blockQ[i * 4], blockQ[i * 4 + 1], blockQ[i * 4 + 2], blockQ[i * 4 + 3]);
+    filter_Y(bs, qPav, blockP(i, 0), blockP(i, 1), blockP(i, 2), blockP(i, 3), blockQ(i, 0), blockQ(i, 1), blockQ(i, 2), blockQ(i, 3));
 }
 
 void deblock_Cr_Cb_vertical(int cur_pos, MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
@@ -124,8 +124,8 @@ void deblock_Cr_Cb_vertical(int cur_pos, MacroBlock& mb, std::vector<MacroBlock>
 
   int qPav = (CHROMA_QP + CHROMA_QP) >> 1;
   for (int i = 0; i != 4; i++) {
-    filter_Cr_Cb(bs, qPav, blockP_Cr[i * 4], blockP_Cr[i * 4 + 1], blockP_Cr[i * 4 + 2], blockP_Cr[i * 4 + 3], blockQ_Cr[i * 4], blockQ_Cr[i * 4 + 1], blockQ_Cr[i * 4 + 2], blockQ_Cr[i * 4 + 3]);
-    filter_Cr_Cb(bs, qPav, blockP_Cb[i * 4], blockP_Cb[i * 4 + 1], blockP_Cb[i * 4 + 2], blockP_Cb[i * 4 + 3], blockQ_Cb[i * 4], blockQ_Cb[i * 4 + 1], blockQ_Cb[i * 4 + 2], blockQ_Cb[i * 4 + 3]);
+    filter_Cr_Cb(bs, qPav, blockP_Cr(i, 0), blockP_Cr(i, 1), blockP_Cr(i, 2), blockP_Cr(i, 3), blockQ_Cr(i, 0), blockQ_Cr(i, 1), blockQ_Cr(i, 2), blockQ_Cr(i, 3));
+    filter_Cr_Cb(bs, qPav, blockP_Cb(i, 0), blockP_Cb(i, 1), blockP_Cb(i, 2), blockP_Cb(i, 3), blockQ_Cb(i, 0), blockQ_Cb(i, 1), blockQ_Cb(i, 2), blockQ_Cb(i, 3));
   }
 }
 
@@ -164,8 +164,8 @@ void deblock_Cr_Cb_horizontal(int cur_pos, MacroBlock& mb, std::vector<MacroBloc
 
   int qPav = (CHROMA_QP + CHROMA_QP) >> 1;
   for (int i = 0; i != 4; i++) {
-    filter_Cr_Cb(bs, qPav, blockP_Cr[i * 4], blockP_Cr[i * 4 + 1], blockP_Cr[i * 4 + 2], blockP_Cr[i * 4 + 3], blockQ_Cr[i * 4], blockQ_Cr[i * 4 + 1], blockQ_Cr[i * 4 + 2], blockQ_Cr[i * 4 + 3]);
-    filter_Cr_Cb(bs, qPav, blockP_Cb[i * 4], blockP_Cb[i * 4 + 1], blockP_Cb[i * 4 + 2], blockP_Cb[i * 4 + 3], blockQ_Cb[i * 4], blockQ_Cb[i * 4 + 1], blockQ_Cb[i * 4 + 2], blockQ_Cb[i * 4 + 3]);
+    filter_Cr_Cb(bs, qPav, blockP_Cr(i, 0), blockP_Cr(i, 1), blockP_Cr(i, 2), blockP_Cr(i, 3), blockQ_Cr(i, 0), blockQ_Cr(i, 1), blockQ_Cr(i, 2), blockQ_Cr(i, 3));
+    filter_Cr_Cb(bs, qPav, blockP_Cb(i, 0), blockP_Cb(i, 1), blockP_Cb(i, 2), blockP_Cb(i, 3), blockQ_Cb(i, 0), blockQ_Cb(i, 1), blockQ_Cb(i, 2), blockQ_Cb(i, 3));
   }
 }
 
@@ -6,6 +6,8 @@
 #include "frame.h"
 #include "frame_encode.h"
 #include "frame_vlc.h"
+#include "frame_cabac.h"
+#include "frame_cache.h"
 #include <chrono>
 #include "worker.h"
 
@@ -13,6 +15,26 @@
 
 Log logger("Main");
 
+// CAVLC contexts, one for every frame in flight
+NCContext nc_contexts[MAX_THREADS];
+
+// last coded frame, -dedup
+FrameCache frame_cache;
+
+/* Entropy code the frame with the coder the Writer was set up for,
+ * slot picks the CAVLC contexts of the thread
+ */
+void entropy_code_frame(Frame& frame, const Writer& writer, const int slot) {
+  // a duplicate comes coded from the frame cache
+  if (frame.is_duplicate())
+    return;
+
+  if (writer.cabac())
+    cabac_frame(frame);
+  else
+    vlc_frame(frame, nc_contexts[slot]);
+}
+
 void* operator new(std::size_t n) {
     // std::cerr << "[allocating " << n << " bytes]\n";
     return malloc(n);
@@ -36,13 +58,24 @@ void run_enc_vlc(Worker_encode_one_frame *const args)
   #ifdef DBG_LOG
   auto begin_vlc = std::chrono::high_resolution_clock::now();
   #endif
-  vlc_frame(*(args->frame));
+  entropy_code_frame(*(args->frame), *(args->writer), args->threadId);
   #ifdef DBG_LOG
   auto end_vlc = std::chrono::high_resolution_clock::now();
   auto dur_vlc = end_vlc - begin_vlc;
   auto us_vlc = std::chrono::duration_cast<std::chrono::microseconds>(dur_vlc).count();
   printf("[DBG] vlc th%d start at %ld , finish at %ld , cost %ld us\n", args->threadId, begin_vlc, end_vlc, us_vlc);
   #endif
+
+  #ifdef DBG_LOG
+  auto begin_package = std::chrono::high_resolution_clock::now();
+  #endif
+  args->slice = args->writer->package_slice(args->frame_num, *(args->frame));
+  #ifdef DBG_LOG
+  auto end_package = std::chrono::high_resolution_clock::now();
+  auto dur_package = end_package - begin_package;
+  auto us_package = std::chrono::duration_cast<std::chrono::microseconds>(dur_package).count();
+  printf("[DBG] package slice th%d cost %ld us\n", args->threadId, us_package);
+  #endif
 }
 
 void encode_sequence(Reader& reader, Writer& writer, Util& util) {
@@ -60,6 +93,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
 
     // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
     Frame frame(reader.get_padded_frame());
+    frame_cache.lookup(frame);
     #ifdef DBG_LOG
     auto end_read_raw = std::chrono::high_resolution_clock::now();
     auto dur_read_raw = end_read_raw - begin_read_raw;
@@ -88,7 +122,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       #ifdef DBG_LOG
       auto begin_vlc = std::chrono::high_resolution_clock::now();
       #endif
-      vlc_frame(frame);
+      entropy_code_frame(frame, writer, 0);
       #ifdef DBG_LOG
       auto end_vlc = std::chrono::high_resolution_clock::now();
       auto dur_vlc = end_vlc - begin_vlc;
@@ -100,6 +134,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       printf("[DBG] whole encode cost %ld us\n", us_whole_encode);
       #endif
       writer.write_slice(curr_frame, frame);
+      frame_cache.store(frame);
 
       #ifdef DBG_LOG
       auto end_one_frame = std::chrono::high_resolution_clock::now();
@@ -123,11 +158,13 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
     #endif
     // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
     Frame frame0(reader.get_padded_frame());
+    frame_cache.lookup(frame0);
     logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame));
 
     if (reader.nb_frames - curr_frame >= 2) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       #ifdef DBG_LOG
       auto end_read_raw = std::chrono::high_resolution_clock::now();
       auto dur_read_raw = end_read_raw - begin_read_raw;
@@ -141,7 +178,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       auto begin_encode_I_frame = std::chrono::high_resolution_clock::now();
       #endif
  
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
       auto begin_th1_create = std::chrono::high_resolution_clock::now();
       printf("[DBG] create th1 start at %ld\n", begin_th1_create);
       // run thread 1
@@ -160,7 +197,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       #ifdef DBG_LOG
       auto begin_vlc = std::chrono::high_resolution_clock::now();
       #endif
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
       #ifdef DBG_LOG
       auto end_vlc = std::chrono::high_resolution_clock::now();
       auto dur_vlc = end_vlc - begin_vlc;
@@ -169,6 +206,7 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
 
 
       #endif
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers.join();
       auto th1_finish = std::chrono::high_resolution_clock::now();
@@ -180,8 +218,8 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       printf("[DBG] whole encode cost %ld us\n", us_whole_encode);
       #endif
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
+      writer.write_slices({&slice0, &worker_one_frame1.slice});
+      frame_cache.store(frame1);
       #ifdef DBG_LOG
       auto end_one_frame = std::chrono::high_resolution_clock::now();
       auto dur_one_frame = end_one_frame - begin_read_raw;
@@ -198,9 +236,10 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       curr_frame += 2;
     } else {
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
 
       writer.write_slice(curr_frame, frame0);
+      frame_cache.store(frame0);
       curr_frame++;
     }
 #elif (MAX_THREADS == 3)
@@ -212,14 +251,17 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
 
     // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
     Frame frame0(reader.get_padded_frame());
+    frame_cache.lookup(frame0);
     logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame));
 
     if (reader.nb_frames - curr_frame >= 3) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+1));
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame2(reader.get_padded_frame());
+      frame_cache.lookup(frame2);
       #ifdef DBG_LOG
       auto end_read_raw = std::chrono::high_resolution_clock::now();
       auto dur_read_raw = end_read_raw - begin_read_raw;
@@ -233,8 +275,8 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       auto begin_encode_I_frame = std::chrono::high_resolution_clock::now();
       #endif 
  
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
-      Worker_encode_one_frame worker_one_frame2(2, &frame2);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
+      Worker_encode_one_frame worker_one_frame2(2, &frame2, &writer, curr_frame+2);
       auto begin_th1_create = std::chrono::high_resolution_clock::now();
       printf("[DBG] create th1/th2 start at %ld\n", begin_th1_create);
 
@@ -256,13 +298,14 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       #ifdef DBG_LOG
       auto begin_vlc = std::chrono::high_resolution_clock::now();
       #endif
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
       #ifdef DBG_LOG
       auto end_vlc = std::chrono::high_resolution_clock::now();
       auto dur_vlc = end_vlc - begin_vlc;
       auto us_vlc = std::chrono::duration_cast<std::chrono::microseconds>(dur_vlc).count();
       printf("[DBG] vlc main thread start at %ld , finish at %ld , cost %ld us\n", begin_vlc, end_vlc, us_vlc);
       #endif
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers[0].join();
       workers[1].join();
@@ -275,9 +318,8 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       printf("[DBG] whole encode cost %ld us\n", us_whole_encode);
       #endif
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
-      writer.write_slice(curr_frame+2, frame2);
+      writer.write_slices({&slice0, &worker_one_frame1.slice, &worker_one_frame2.slice});
+      frame_cache.store(frame2);
 
       #ifdef DBG_LOG
       auto end_one_frame = std::chrono::high_resolution_clock::now();
@@ -295,25 +337,28 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
     } else if (reader.nb_frames - curr_frame >= 2) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+1));
 
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
       // run thread 1
       workers[0] = std::thread(run_enc_vlc, &worker_one_frame1);
       
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers[0].join();
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
+      writer.write_slices({&slice0, &worker_one_frame1.slice});
+      frame_cache.store(frame1);
       curr_frame += 2;
     } else {
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
 
       writer.write_slice(curr_frame, frame0);
+      frame_cache.store(frame0);
       curr_frame++;
     }
 
@@ -325,17 +370,21 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
     #endif
     // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
     Frame frame0(reader.get_padded_frame());
+    frame_cache.lookup(frame0);
     logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame));
 
     if (reader.nb_frames - curr_frame >= 4) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+1));
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame2(reader.get_padded_frame());
+      frame_cache.lookup(frame2);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+2));
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame3(reader.get_padded_frame());
+      frame_cache.lookup(frame3);
       #ifdef DBG_LOG
       auto end_read_raw = std::chrono::high_resolution_clock::now();
       auto dur_read_raw = end_read_raw - begin_read_raw;
@@ -349,9 +398,9 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       auto begin_encode_I_frame = std::chrono::high_resolution_clock::now();
       #endif 
  
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
-      Worker_encode_one_frame worker_one_frame2(2, &frame2);
-      Worker_encode_one_frame worker_one_frame3(3, &frame3);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
+      Worker_encode_one_frame worker_one_frame2(2, &frame2, &writer, curr_frame+2);
+      Worker_encode_one_frame worker_one_frame3(3, &frame3, &writer, curr_frame+3);
       auto begin_th1_create = std::chrono::high_resolution_clock::now();
       printf("[DBG] create th1/th2/th3 start at %ld\n", begin_th1_create);
 
@@ -375,13 +424,14 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       #ifdef DBG_LOG
       auto begin_vlc = std::chrono::high_resolution_clock::now();
       #endif
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
       #ifdef DBG_LOG
       auto end_vlc = std::chrono::high_resolution_clock::now();
       auto dur_vlc = end_vlc - begin_vlc;
       auto us_vlc = std::chrono::duration_cast<std::chrono::microseconds>(dur_vlc).count();
       printf("[DBG] vlc main thread start at %ld , finish at %ld , cost %ld us\n", begin_vlc, end_vlc, us_vlc);
       #endif
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers[0].join();
       workers[1].join();
@@ -395,10 +445,8 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       printf("[DBG] whole encode cost %ld us\n", us_whole_encode);
       #endif
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
-      writer.write_slice(curr_frame+2, frame2);
-      writer.write_slice(curr_frame+3, frame3);
+      writer.write_slices({&slice0, &worker_one_frame1.slice, &worker_one_frame2.slice, &worker_one_frame3.slice});
+      frame_cache.store(frame3);
       #ifdef DBG_LOG
       auto end_one_frame = std::chrono::high_resolution_clock::now();
       auto dur_one_frame = end_one_frame - begin_read_raw;
@@ -416,13 +464,15 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
     } else if (reader.nb_frames - curr_frame >= 3) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+1));
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame2(reader.get_padded_frame());
+      frame_cache.lookup(frame2);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+2));
 
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
-      Worker_encode_one_frame worker_one_frame2(2, &frame2);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
+      Worker_encode_one_frame worker_one_frame2(2, &frame2, &writer, curr_frame+2);
 
       // run thread 1
       workers[0] = std::thread(run_enc_vlc, &worker_one_frame1);
@@ -430,38 +480,41 @@ void encode_sequence(Reader& reader, Writer& writer, Util& util) {
       workers[1] = std::thread(run_enc_vlc, &worker_one_frame2);
       
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers[0].join();
       workers[1].join();
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
-      writer.write_slice(curr_frame+2, frame2);
+      writer.write_slices({&slice0, &worker_one_frame1.slice, &worker_one_frame2.slice});
+      frame_cache.store(frame2);
       curr_frame += 3;
 
     } else if (reader.nb_frames - curr_frame >= 2) {
       // reader讀進raw data轉成YCbCr,然後frame會切成16x16的MB儲存在mbs
       Frame frame1(reader.get_padded_frame());
+      frame_cache.lookup(frame1);
       logger.log(Level::NORMAL, "encode frame #" + std::to_string(curr_frame+1));
 
-      Worker_encode_one_frame worker_one_frame1(1, &frame1);
+      Worker_encode_one_frame worker_one_frame1(1, &frame1, &writer, curr_frame+1);
       // run thread 1
       workers[0] = std::thread(run_enc_vlc, &worker_one_frame1);
       
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
+      Bitstream slice0 = writer.package_slice(curr_frame, frame0);
 
       workers[0].join();
 
-      writer.write_slice(curr_frame, frame0);
-      writer.write_slice(curr_frame+1, frame1);
+      writer.write_slices({&slice0, &worker_one_frame1.slice});
+      frame_cache.store(frame1);
       curr_frame += 2;
     } else {
       encode_I_frame(frame0);
-      vlc_frame(frame0);
+      entropy_code_frame(frame0, writer, 0);
 
       writer.write_slice(curr_frame, frame0);
+      frame_cache.store(frame0);
       curr_frame++;
     }
 
@@ -480,7 +533,7 @@ int main(int argc, const char *argv[]) {
   Reader reader(util.input_file, util.width, util.height);
 
   // Write to given filename
-  Writer writer(util.output_file);
+  Writer writer(util.output_file, util.output_format, util.fps, util.segment_frames, util.cabac);
 
   // Encoding process start
   encode_sequence(reader, writer, util);
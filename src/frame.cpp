@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "frame.h"
 
 RawFrame::RawFrame(const int w, const int h): width(w), height(h) {}
@@ -129,6 +131,7 @@ Frame::Frame(const PadFrame& pf): type(I_PICTURE), width(pf.width), height(pf.he
   // Set arguments of frame
   this->nb_mb_rows = nb_rows;
   this->nb_mb_cols = nb_cols;
+  this->cached_rows = 0;
 }
 
 int Frame::get_neighbor_index(const int curr_index, const int neighbor_type) {
@@ -170,3 +173,44 @@ int Frame::get_neighbor_index(const int curr_index, const int neighbor_type) {
     neighbor_index = -1;
   return neighbor_index;
 }
+
+/* predIntra4x4PredMode of the 4x4 block at cur_pos (coding order)
+ *
+ * DC if the left or the upper block is outside the frame. A neighbour
+ * macroblock coded without intra4x4 counts as DC.
+ */
+int Frame::predict_intra4x4_mode(MacroBlock& mb, const int cur_pos) {
+  int real_pos = MacroBlock::convert_table[cur_pos];
+
+  int pmA_index, pmA_pos;
+  if (real_pos % 4 == 0) {
+    pmA_index = this->get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+    pmA_pos = real_pos + 3;
+  } else {
+    pmA_index = mb.mb_index;
+    pmA_pos = real_pos - 1;
+  }
+  pmA_pos = MacroBlock::convert_table[pmA_pos];
+
+  int pmB_index, pmB_pos;
+  if (0 <= real_pos && real_pos <= 3) {
+    pmB_index = this->get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+    pmB_pos = 12 + real_pos;
+  } else {
+    pmB_index = mb.mb_index;
+    pmB_pos = real_pos - 4;
+  }
+  pmB_pos = MacroBlock::convert_table[pmB_pos];
+
+  if (pmA_index == -1 || pmB_index == -1)
+    return 2;
+
+  auto pred_mode = [&](const int index, const int pos) {
+    MacroBlock& neighbor = (index == mb.mb_index) ? mb : this->mbs.at(index);
+    if (neighbor.is_I_PCM || neighbor.is_intra16x16)
+      return 2;
+    return static_cast<int>(neighbor.intra4x4_Y_mode.at(pos));
+  };
+
+  return std::min(pred_mode(pmA_index, pmA_pos), pred_mode(pmB_index, pmB_pos));
+}
@@ -0,0 +1,242 @@
+#include "frame_cabac.h"
+#include "qdct.h"
+
+static int cbp_luma(const MacroBlock& mb) {
+  if (mb.is_intra16x16)
+    return mb.coded_block_pattern_luma ? 0x0f : 0;
+
+  int cbp = 0;
+  for (int i = 0; i != 4; i++)
+    if (mb.coded_block_pattern_luma_4x4[i])
+      cbp |= 1 << i;
+  return cbp;
+}
+
+static int cbp_chroma(const MacroBlock& mb) {
+  if (mb.coded_block_pattern_chroma_AC)
+    return 2;
+  return mb.coded_block_pattern_chroma_DC ? 1 : 0;
+}
+
+/* condTermFlagN of coded_block_flag
+ * a neighbour outside the frame (of an intra macroblock) or in I_PCM counts as coded
+ */
+static int coded_block_cond(const MacroBlock* neighbor, const std::uint32_t bit) {
+  if (neighbor == nullptr || neighbor->is_I_PCM)
+    return 1;
+  return (neighbor->nonzero_mask & bit) != 0;
+}
+
+static void cabac_mb_type(CABACEncoder& cabac, const MacroBlock& mb, const MacroBlock* A, const MacroBlock* B) {
+  auto cond = [](const MacroBlock* neighbor) {
+    return neighbor != nullptr && (neighbor->is_I_PCM || neighbor->is_intra16x16);
+  };
+  int ctx = CTX_MB_TYPE_I + cond(A) + cond(B);
+
+  if (mb.is_I_PCM) {
+    cabac.encode_decision(ctx, 1);
+    cabac.encode_terminate(1);
+    return;
+  }
+  if (!mb.is_intra16x16) {
+    cabac.encode_decision(ctx, 0);
+    return;
+  }
+
+  // I_16x16_<pred mode>_<chroma cbp>_<luma cbp>
+  int chroma = cbp_chroma(mb);
+  int mode = static_cast<int>(mb.intra16x16_Y_mode);
+  cabac.encode_decision(ctx, 1);
+  cabac.encode_terminate(0);
+  cabac.encode_decision(CTX_MB_TYPE_I + 3, mb.coded_block_pattern_luma);
+  cabac.encode_decision(CTX_MB_TYPE_I + 4, chroma != 0);
+  if (chroma != 0)
+    cabac.encode_decision(CTX_MB_TYPE_I + 5, chroma == 2);
+  cabac.encode_decision(CTX_MB_TYPE_I + 6, mode >> 1);
+  cabac.encode_decision(CTX_MB_TYPE_I + 7, mode & 1);
+}
+
+static void cabac_mb_pred(CABACEncoder& cabac, MacroBlock& mb, const MacroBlock* A, const MacroBlock* B, Frame& frame) {
+  if (!mb.is_intra16x16) {
+    for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
+      int pred_mode = frame.predict_intra4x4_mode(mb, cur_pos);
+      int cur_mode = static_cast<int>(mb.intra4x4_Y_mode.at(cur_pos));
+      if (pred_mode == cur_mode) {
+        cabac.encode_decision(CTX_PREV_INTRA4x4_PRED_MODE, 1);
+      } else {
+        cabac.encode_decision(CTX_PREV_INTRA4x4_PRED_MODE, 0);
+        int rem_mode = (cur_mode < pred_mode) ? cur_mode : cur_mode - 1;
+        for (int bit = 0; bit != 3; bit++)
+          cabac.encode_decision(CTX_REM_INTRA4x4_PRED_MODE, (rem_mode >> bit) & 1);
+      }
+    }
+  }
+
+  auto cond = [](const MacroBlock* neighbor) {
+    return neighbor != nullptr && !neighbor->is_I_PCM && neighbor->intra_Cr_Cb_mode != IntraChromaMode::DC;
+  };
+  int mode = static_cast<int>(mb.intra_Cr_Cb_mode);
+  cabac.encode_decision(CTX_INTRA_CHROMA_PRED_MODE + cond(A) + cond(B), mode != 0);
+  for (int i = 1; i <= mode && i != 3; i++)
+    cabac.encode_decision(CTX_INTRA_CHROMA_PRED_MODE + 3, mode > i);
+}
+
+static void cabac_coded_block_pattern(CABACEncoder& cabac, const MacroBlock& mb, const MacroBlock* A, const MacroBlock* B) {
+  // a missing or I_PCM neighbour has all its 8x8 blocks coded
+  int cbp = cbp_luma(mb);
+  int cbp_A = (A == nullptr || A->is_I_PCM) ? 0x0f : cbp_luma(*A);
+  int cbp_B = (B == nullptr || B->is_I_PCM) ? 0x0f : cbp_luma(*B);
+  for (int b8 = 0; b8 != 4; b8++) {
+    int coded_A = (b8 & 1) ? (cbp >> (b8 - 1)) & 1 : (cbp_A >> (b8 + 1)) & 1;
+    int coded_B = (b8 & 2) ? (cbp >> (b8 - 2)) & 1 : (cbp_B >> (b8 + 2)) & 1;
+    cabac.encode_decision(CTX_CBP_LUMA + !coded_A + 2 * !coded_B, (cbp >> b8) & 1);
+  }
+
+  auto chroma_of = [](const MacroBlock* neighbor) {
+    if (neighbor == nullptr)
+      return 0;
+    return neighbor->is_I_PCM ? 2 : cbp_chroma(*neighbor);
+  };
+  int chroma = cbp_chroma(mb);
+  int chroma_A = chroma_of(A);
+  int chroma_B = chroma_of(B);
+  cabac.encode_decision(CTX_CBP_CHROMA + (chroma_A != 0) + 2 * (chroma_B != 0), chroma != 0);
+  if (chroma != 0)
+    cabac.encode_decision(CTX_CBP_CHROMA + 4 + (chroma_A == 2) + 2 * (chroma_B == 2), chroma == 2);
+}
+
+static void cabac_luma(CABACEncoder& cabac, MacroBlock& mb, const MacroBlock* A, const MacroBlock* B) {
+  ScannedBlock scan;
+  const BlockCat cat = mb.is_intra16x16 ? BlockCat::LUMA_AC : BlockCat::LUMA_4x4;
+  const int cbp = cbp_luma(mb);
+
+  for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
+    if (!(cbp & (1 << (cur_pos / 4))))
+      continue;
+
+    // neighbouring 4x4 blocks, convert_table maps raster to coding order and back
+    int real_pos = MacroBlock::convert_table[cur_pos];
+    int x = real_pos % 4, y = real_pos / 4;
+    int inc_A = (x > 0) ? coded_block_cond(&mb, 1u << MacroBlock::convert_table[real_pos - 1])
+                        : coded_block_cond(A, 1u << MacroBlock::convert_table[real_pos + 3]);
+    int inc_B = (y > 0) ? coded_block_cond(&mb, 1u << MacroBlock::convert_table[real_pos - 4])
+                        : coded_block_cond(B, 1u << MacroBlock::convert_table[real_pos + 12]);
+
+    if (!(mb.nonzero_mask & (1u << cur_pos))) {
+      cabac.encode_empty_block(cat, inc_A + 2 * inc_B);
+      continue;
+    }
+    if (mb.is_intra16x16)
+      scan_coeffs(mb.get_Y_AC_block(cur_pos), scan);
+    else
+      scan_coeffs(mb.get_Y_4x4_block(cur_pos), scan);
+    cabac.encode_residual_block(scan, cat, inc_A + 2 * inc_B);
+  }
+}
+
+static void cabac_chroma(CABACEncoder& cabac, MacroBlock& mb, const MacroBlock* A, const MacroBlock* B) {
+  ScannedBlock scan;
+  const int chroma = cbp_chroma(mb);
+  if (chroma == 0)
+    return;
+
+  for (int cb_cr = 0; cb_cr != 2; cb_cr++) {
+    std::uint32_t bit = cb_cr ? NONZERO_CR_DC : NONZERO_CB_DC;
+    int inc = coded_block_cond(A, bit) + 2 * coded_block_cond(B, bit);
+    if (!(mb.nonzero_mask & bit)) {
+      cabac.encode_empty_block(BlockCat::CHROMA_DC, inc);
+      continue;
+    }
+    scan_coeffs(cb_cr ? mb.get_Cr_DC_block() : mb.get_Cb_DC_block(), scan);
+    cabac.encode_residual_block(scan, BlockCat::CHROMA_DC, inc);
+  }
+
+  if (chroma != 2)
+    return;
+
+  for (int cb_cr = 0; cb_cr != 2; cb_cr++) {
+    int shift = cb_cr ? NONZERO_CR_AC_SHIFT : NONZERO_CB_AC_SHIFT;
+    for (int cur_pos = 0; cur_pos != 4; cur_pos++) {
+      int x = cur_pos % 2, y = cur_pos / 2;
+      int inc_A = (x > 0) ? coded_block_cond(&mb, 1u << (shift + cur_pos - 1))
+                          : coded_block_cond(A, 1u << (shift + cur_pos + 1));
+      int inc_B = (y > 0) ? coded_block_cond(&mb, 1u << (shift + cur_pos - 2))
+                          : coded_block_cond(B, 1u << (shift + cur_pos + 2));
+
+      if (!(mb.nonzero_mask & (1u << (shift + cur_pos)))) {
+        cabac.encode_empty_block(BlockCat::CHROMA_AC, inc_A + 2 * inc_B);
+        continue;
+      }
+      scan_coeffs(cb_cr ? mb.get_Cr_AC_block(cur_pos) : mb.get_Cb_AC_block(cur_pos), scan);
+      cabac.encode_residual_block(scan, BlockCat::CHROMA_AC, inc_A + 2 * inc_B);
+    }
+  }
+}
+
+/* Slice data of the whole frame in CABAC
+ *
+ * Unlike CAVLC the macroblocks cannot be coded apart, the arithmetic
+ * coder runs through the frame and leaves the byte aligned slice data,
+ * rbsp_stop_one_bit included, in the frame arena.
+ */
+void cabac_frame(Frame& frame) {
+  Bitstream& arena = frame.mb_bitstream;
+  arena.reserve(frame.mbs.size() * 48);
+
+  CABACEncoder cabac(arena);
+  cabac.init_contexts(LUMA_QP);
+
+  for (std::size_t i = 0; i != frame.mbs.size(); i++) {
+    MacroBlock& mb = frame.mbs[i];
+    int A_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+    int B_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+    const MacroBlock* A = (A_index == -1) ? nullptr : &frame.mbs[A_index];
+    const MacroBlock* B = (B_index == -1) ? nullptr : &frame.mbs[B_index];
+
+    cabac_mb_type(cabac, mb, A, B);
+
+    if (mb.is_I_PCM) {
+      // pcm_alignment_zero_bit
+      if (!arena.byte_align())
+        arena += Bitstream(static_cast<std::uint8_t>(0), 8 - arena.nb_bits % 8);
+
+      // pcm_sample_luma, pcm_sample_chroma
+      std::uint8_t samples[256 + 64 + 64];
+      std::copy(mb.Y.begin(), mb.Y.end(), samples);
+      std::copy(mb.Cb.begin(), mb.Cb.end(), samples + 256);
+      std::copy(mb.Cr.begin(), mb.Cr.end(), samples + 256 + 64);
+      arena.append_aligned(samples, sizeof(samples));
+
+      cabac.init_engine();
+    } else {
+      cabac_mb_pred(cabac, mb, A, B, frame);
+      if (!mb.is_intra16x16)
+        cabac_coded_block_pattern(cabac, mb, A, B);
+
+      if (cbp_luma(mb) != 0 || cbp_chroma(mb) != 0 || mb.is_intra16x16) {
+        // mb_qp_delta, always 0
+        cabac.encode_decision(CTX_MB_QP_DELTA, 0);
+
+        if (mb.is_intra16x16) {
+          int inc = coded_block_cond(A, NONZERO_LUMA_DC) + 2 * coded_block_cond(B, NONZERO_LUMA_DC);
+          if (mb.nonzero_mask & NONZERO_LUMA_DC) {
+            ScannedBlock scan;
+            scan_coeffs(mb.get_Y_DC_block(), scan);
+            cabac.encode_residual_block(scan, BlockCat::LUMA_DC, inc);
+          } else {
+            cabac.encode_empty_block(BlockCat::LUMA_DC, inc);
+          }
+        }
+        cabac_luma(cabac, mb, A, B);
+        cabac_chroma(cabac, mb, A, B);
+      }
+    }
+
+    // end_of_slice_flag
+    cabac.encode_terminate(i + 1 == frame.mbs.size());
+  }
+
+  // rbsp_alignment_zero_bit
+  if (!arena.byte_align())
+    arena += Bitstream(static_cast<std::uint8_t>(0), 8 - arena.nb_bits % 8);
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstring>
+
+#include "frame_cache.h"
+
+bool FrameCache::enabled = false;
+
+// source samples of one macroblock, Y then Cr and Cb
+static const int mb_samples = 256 + 64 + 64;
+
+/* Copy the source samples of a row of macroblocks to samples
+ * and return their FNV-1a hash
+ */
+static std::uint64_t hash_mb_row(const MacroBlock* mbs, const int nb_mbs, int* samples) {
+  for (int i = 0; i != nb_mbs; i++) {
+    std::copy_n(mbs[i].Y.data(), 256, samples + i * mb_samples);
+    std::copy_n(mbs[i].Cr.data(), 64, samples + i * mb_samples + 256);
+    std::copy_n(mbs[i].Cb.data(), 64, samples + i * mb_samples + 320);
+  }
+
+  std::uint64_t hash = 0xcbf29ce484222325;
+  for (int i = 0; i != nb_mbs * mb_samples; i++) {
+    hash ^= static_cast<std::uint32_t>(samples[i]);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+FrameCache::FrameCache(): logger("Frame cache") {}
+
+/* Hash the rows of a frame that is not coded yet and take over
+ * the leading rows it shares with the cached frame
+ */
+void FrameCache::lookup(Frame& frame) {
+  if (!enabled)
+    return;
+
+  const int row_size = frame.nb_mb_cols * mb_samples;
+  frame.row_hashes.resize(frame.nb_mb_rows);
+  frame.row_samples.resize(frame.nb_mb_rows * row_size);
+  for (int row = 0; row != frame.nb_mb_rows; row++)
+    frame.row_hashes[row] = hash_mb_row(&frame.mbs[row * frame.nb_mb_cols], frame.nb_mb_cols,
+                                        &frame.row_samples[row * row_size]);
+
+  // nothing cached yet
+  if (row_hashes.size() != frame.row_hashes.size())
+    return;
+
+  // a hash collision must not bring in another row
+  int rows = 0;
+  while (rows != frame.nb_mb_rows && frame.row_hashes[rows] == row_hashes[rows] &&
+         std::memcmp(&frame.row_samples[rows * row_size], &row_samples[rows * row_size],
+                     row_size * sizeof(int)) == 0)
+    rows++;
+  if (rows == 0)
+    return;
+
+  const int nb_mbs = rows * frame.nb_mb_cols;
+  std::copy_n(mbs.begin(), nb_mbs, frame.mbs.begin());
+  frame.cached_rows = rows;
+  if (frame.is_duplicate()) {
+    frame.mb_bitstream = mb_bitstream;
+    logger.log(Level::VERBOSE, "duplicate of the last coded frame");
+  } else {
+    frame.decoded_blocks.assign(decoded_blocks.begin(), decoded_blocks.begin() + nb_mbs);
+    logger.log(Level::VERBOSE, std::to_string(rows) + " MB rows taken from the last coded frame");
+  }
+}
+
+/* Keep a coded frame for the next lookups
+ * a duplicate is in the cache already
+ */
+void FrameCache::store(const Frame& frame) {
+  if (!enabled || frame.is_duplicate())
+    return;
+
+  row_hashes = frame.row_hashes;
+  row_samples = frame.row_samples;
+  mbs = frame.mbs;
+  decoded_blocks = frame.decoded_blocks;
+  mb_bitstream = frame.mb_bitstream;
+}
@@ -1,18 +1,319 @@
 #include <thread>
+#include <limits>
+#include <cmath>
 #include "frame_encode.h"
 #include "worker.h"
+#include "vlc.h"
+#include "sad.h"
+#include "frame_cache.h"
 #include <chrono>
 
 Log f_logger("Frame encode");
 
+// intra16x16 leaving less than 2 per sample is not worth a 4x4 search
+static const int intra4x4_min_error_16x16 = 2 * 16 * 16;
+
+/* Rate-distortion mode decision, -cost rd
+ *
+ * A mode costs the SSD of its reconstruction plus lambda times its
+ * CAVLC bits, mode signalling and residual. Lambda is the usual
+ * 0.85 * 2^((QP - 12) / 3) for SSD. The CABAC stream is decided with
+ * the same CAVLC counts.
+ */
+static const int rd_lambda = std::lround(0.85 * std::pow(2.0, (LUMA_QP - 12) / 3.0));
+
+// mb_type I_PCM and the 384 samples, the alignment left out
+static const int rd_pcm_bits = ue_bits(25) + 384 * 8;
+
+static bool rd_decision() {
+  return ModeCost::metric == CostMetric::RATE_DISTORTION;
+}
+
+/* SSD between the original and the reconstruction
+ */
+static int rd_ssd(const int* original, const int* reconstruction, const int n) {
+  int ssd = 0;
+  for (int i = 0; i != n; i++) {
+    int diff = original[i] - reconstruction[i];
+    ssd += diff * diff;
+  }
+  return ssd;
+}
+
+/* nC from the TotalCoeff of the left and upper blocks, -1 if unavailable
+ */
+static int rd_nc(const int nA, const int nB) {
+  if (nA >= 0 && nB >= 0)
+    return (nA + nB + 1) >> 1;
+  return (nA >= 0) ? nA : ((nB >= 0) ? nB : 0);
+}
+
+/* TotalCoeff of a coded 4x4 luma block, pos in coding order
+ */
+static int luma_total_coeff(MacroBlock& mb, const int pos) {
+  if (mb.is_I_PCM)
+    return 16;
+  if (!(mb.nonzero_mask & (1 << pos)))
+    return 0;
+
+  ScannedBlock scanned;
+  if (mb.is_intra16x16)
+    scan_coeffs(mb.get_Y_AC_block(pos), scanned);
+  else
+    scan_coeffs(mb.get_Y_4x4_block(pos), scanned);
+  return __builtin_popcount(scanned.nonzero);
+}
+
+/* TotalCoeff of a coded 4x4 chroma AC block, shift picks Cb or Cr
+ */
+static int chroma_total_coeff(MacroBlock& mb, const int shift, const int pos) {
+  if (mb.is_I_PCM)
+    return 16;
+  if (!(mb.nonzero_mask & (1 << (shift + pos))))
+    return 0;
+
+  ScannedBlock scanned;
+  if (shift == NONZERO_CB_AC_SHIFT)
+    scan_coeffs(mb.get_Cb_AC_block(pos), scanned);
+  else
+    scan_coeffs(mb.get_Cr_AC_block(pos), scanned);
+  return __builtin_popcount(scanned.nonzero);
+}
+
+/* nC of the luma block at cur_pos, the neighbours found as in
+ * Frame::predict_intra4x4_mode, mb stands in for the current macroblock
+ */
+static int luma_nc(Frame& frame, MacroBlock& mb, const int cur_pos) {
+  auto total_coeff = [&](const int index, const int real_pos) {
+    if (index == -1)
+      return -1;
+    MacroBlock& neighbor = (index == mb.mb_index) ? mb : frame.mbs.at(index);
+    return luma_total_coeff(neighbor, MacroBlock::convert_table[real_pos]);
+  };
+
+  int real_pos = MacroBlock::convert_table[cur_pos];
+  int nA = (real_pos % 4 == 0) ? total_coeff(frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L), real_pos + 3)
+                               : total_coeff(mb.mb_index, real_pos - 1);
+  int nB = (real_pos <= 3) ? total_coeff(frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U), real_pos + 12)
+                           : total_coeff(mb.mb_index, real_pos - 4);
+  return rd_nc(nA, nB);
+}
+
+static int chroma_nc(Frame& frame, MacroBlock& mb, const int shift, const int cur_pos) {
+  auto total_coeff = [&](const int index, const int pos) {
+    if (index == -1)
+      return -1;
+    MacroBlock& neighbor = (index == mb.mb_index) ? mb : frame.mbs.at(index);
+    return chroma_total_coeff(neighbor, shift, pos);
+  };
+
+  int nA = (cur_pos % 2 == 0) ? total_coeff(frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L), cur_pos + 1)
+                              : total_coeff(mb.mb_index, cur_pos - 1);
+  int nB = (cur_pos <= 1) ? total_coeff(frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U), cur_pos + 2)
+                          : total_coeff(mb.mb_index, cur_pos - 2);
+  return rd_nc(nA, nB);
+}
+
+/* Nonzero bits of the macroblock from the raster order QDCT masks
+ */
+static void set_luma16x16_nonzero(MacroBlock& mb, const int nonzero_mask) {
+  mb.nonzero_mask &= ~(NONZERO_LUMA | NONZERO_LUMA_DC);
+  for (int i = 0; i != 16; i++)
+    if (nonzero_mask & (1 << MacroBlock::convert_table[i]))
+      mb.nonzero_mask |= 1 << i;
+  if (nonzero_mask & QDCT_DC_NONZERO)
+    mb.nonzero_mask |= NONZERO_LUMA_DC;
+}
+
+static void set_chroma_nonzero(MacroBlock& mb, const int nonzero_mask_Cr, const int nonzero_mask_Cb) {
+  mb.nonzero_mask &= ~(NONZERO_CHROMA_AC | NONZERO_CB_DC | NONZERO_CR_DC);
+  mb.nonzero_mask |= (nonzero_mask_Cb & 0xf) << NONZERO_CB_AC_SHIFT;
+  mb.nonzero_mask |= (nonzero_mask_Cr & 0xf) << NONZERO_CR_AC_SHIFT;
+  if (nonzero_mask_Cb & QDCT_DC_NONZERO)
+    mb.nonzero_mask |= NONZERO_CB_DC;
+  if (nonzero_mask_Cr & QDCT_DC_NONZERO)
+    mb.nonzero_mask |= NONZERO_CR_DC;
+}
+
+/* RD version of intra4x4(), same contract
+ * the mode costs 1 bit if it is the most probable one, 4 otherwise
+ */
+static std::tuple<int, Intra4x4Mode> intra4x4_rd(Block4x4 block, const Predictor& predictor, CopyBlock4x4& pred,
+                                                 const int most_probable, const int nC) {
+  CopyBlock4x4 original, candidate, residual;
+  block.copy_to(original.data());
+
+  const unsigned int modes = intra4x4_search_modes(original, predictor, most_probable);
+  int min_cost = std::numeric_limits<int>::max();
+  Intra4x4Mode best_mode = Intra4x4Mode::DC;
+  for (int mode = 0; mode != 9; mode++) {
+    if (!(modes & (1 << mode)))
+      continue;
+
+    get_intra4x4(candidate, predictor, static_cast<Intra4x4Mode>(mode));
+    get_residual(residual.data(), original.data(), candidate.data(), 16);
+
+    Block4x4 coeffs(residual.data(), 4);
+    int bits = (mode == most_probable) ? 1 : 4;
+    if (qdct_luma4x4_intra(coeffs)) {
+      bits += cavlc_bits_block4x4(coeffs, nC, 16);
+      inv_qdct_luma4x4_intra(coeffs);
+    } else {
+      bits += cavlc_bits_empty_block(nC);
+    }
+
+    get_reconstruction(residual.data(), candidate.data(), 16, 235);
+    int cost = rd_ssd(original.data(), residual.data(), 16) + rd_lambda * bits;
+    if (cost < min_cost) {
+      min_cost = cost;
+      best_mode = static_cast<Intra4x4Mode>(mode);
+      pred = candidate;
+    }
+  }
+
+  get_residual(original.data(), original.data(), pred.data(), 16);
+  block.copy_from(original.data());
+
+  return std::make_tuple(min_cost, best_mode);
+}
+
+/* RD version of intra16x16(), mb holds the original samples
+ * mb_type is counted without the chroma part of the coded block pattern
+ */
+static std::tuple<int, Intra16x16Mode> intra16x16_rd(Frame& frame, MacroBlock& mb, const Predictor& predictor,
+                                                     Block16x16& pred) {
+  MacroBlock trial = mb;
+  trial.is_I_PCM = false;
+  trial.is_intra16x16 = true;
+  Block16x16 candidate;
+  Block16x16* cur = &candidate;
+  Block16x16* best = &pred;
+
+  int min_cost = std::numeric_limits<int>::max();
+  Intra16x16Mode best_mode = Intra16x16Mode::DC;
+  for (int mode = 0; mode != 4; mode++) {
+    if ((!predictor.up_available   && (Intra16x16Mode::VERTICAL   == static_cast<Intra16x16Mode>(mode))) ||
+        (!predictor.left_available && (Intra16x16Mode::HORIZONTAL == static_cast<Intra16x16Mode>(mode))) ||
+        (!predictor.all_available  && (Intra16x16Mode::PLANE      == static_cast<Intra16x16Mode>(mode)))) {
+      continue;
+    }
+
+    get_intra16x16(*cur, predictor, static_cast<Intra16x16Mode>(mode));
+    get_residual(trial.Y.data(), mb.Y.data(), cur->data(), 256);
+    int nonzero_mask = qdct_luma16x16_intra(trial.Y);
+    set_luma16x16_nonzero(trial, nonzero_mask);
+
+    const bool ac = trial.nonzero_mask & NONZERO_LUMA;
+    int bits = ue_bits(1 + mode + (ac ? 12 : 0));
+    int nC = luma_nc(frame, trial, 0);
+    if (trial.nonzero_mask & NONZERO_LUMA_DC)
+      bits += cavlc_bits_block4x4(trial.get_Y_DC_block(), nC, 16);
+    else
+      bits += cavlc_bits_empty_block(nC);
+    for (int i = 0; ac && i != 16; i++) {
+      nC = luma_nc(frame, trial, i);
+      if (trial.nonzero_mask & (1 << i))
+        bits += cavlc_bits_block4x4(trial.get_Y_AC_block(i), nC, 15);
+      else
+        bits += cavlc_bits_empty_block(nC);
+    }
+
+    inv_qdct_luma16x16_intra(trial.Y, nonzero_mask);
+    get_reconstruction(trial.Y.data(), cur->data(), 256, 235);
+    int cost = rd_ssd(mb.Y.data(), trial.Y.data(), 256) + rd_lambda * bits;
+    if (cost < min_cost) {
+      min_cost = cost;
+      best_mode = static_cast<Intra16x16Mode>(mode);
+      std::swap(cur, best);
+    }
+  }
+
+  if (best != &pred)
+    pred = *best;
+  get_residual(mb.Y.data(), mb.Y.data(), pred.data(), 256);
+
+  return std::make_tuple(min_cost, best_mode);
+}
+
+/* RD version of intra8x8_chroma(), mb holds the original samples
+ * the chroma part of the coded block pattern changes mb_type of intra16x16
+ * or coded_block_pattern of intra4x4, neither is counted
+ */
+static std::tuple<int, IntraChromaMode> intra8x8_chroma_rd(Frame& frame, MacroBlock& mb,
+                                                           const Predictor& cr_predictor, Block8x8& cr_pred,
+                                                           const Predictor& cb_predictor, Block8x8& cb_pred) {
+  MacroBlock trial = mb;
+  Block8x8 cr_candidate, cb_candidate;
+
+  int min_cost = std::numeric_limits<int>::max();
+  IntraChromaMode best_mode = IntraChromaMode::DC;
+  for (int mode = 0; mode != 4; mode++) {
+    if ((!cr_predictor.up_available   && (IntraChromaMode::VERTICAL   == static_cast<IntraChromaMode>(mode))) ||
+        (!cr_predictor.left_available && (IntraChromaMode::HORIZONTAL == static_cast<IntraChromaMode>(mode))) ||
+        (!cr_predictor.all_available  && (IntraChromaMode::PLANE      == static_cast<IntraChromaMode>(mode)))) {
+      continue;
+    }
+
+    get_intra8x8_chroma(cr_candidate, cr_predictor, static_cast<IntraChromaMode>(mode));
+    get_intra8x8_chroma(cb_candidate, cb_predictor, static_cast<IntraChromaMode>(mode));
+    get_residual(trial.Cr.data(), mb.Cr.data(), cr_candidate.data(), 64);
+    get_residual(trial.Cb.data(), mb.Cb.data(), cb_candidate.data(), 64);
+    int nonzero_mask_Cr = qdct_chroma8x8_intra(trial.Cr);
+    int nonzero_mask_Cb = qdct_chroma8x8_intra(trial.Cb);
+    set_chroma_nonzero(trial, nonzero_mask_Cr, nonzero_mask_Cb);
+
+    int bits = ue_bits(mode);
+    if (trial.nonzero_mask & (NONZERO_CHROMA_AC | NONZERO_CB_DC | NONZERO_CR_DC)) {
+      bits += (trial.nonzero_mask & NONZERO_CB_DC) ? cavlc_bits_block2x2(trial.get_Cb_DC_block(), -1, 4)
+                                                   : cavlc_bits_empty_block(-1);
+      bits += (trial.nonzero_mask & NONZERO_CR_DC) ? cavlc_bits_block2x2(trial.get_Cr_DC_block(), -1, 4)
+                                                   : cavlc_bits_empty_block(-1);
+    }
+    if (trial.nonzero_mask & NONZERO_CHROMA_AC) {
+      for (int shift : {NONZERO_CB_AC_SHIFT, NONZERO_CR_AC_SHIFT}) {
+        for (int i = 0; i != 4; i++) {
+          int nC = chroma_nc(frame, trial, shift, i);
+          if (!(trial.nonzero_mask & (1 << (shift + i))))
+            bits += cavlc_bits_empty_block(nC);
+          else if (shift == NONZERO_CB_AC_SHIFT)
+            bits += cavlc_bits_block4x4(trial.get_Cb_AC_block(i), nC, 15);
+          else
+            bits += cavlc_bits_block4x4(trial.get_Cr_AC_block(i), nC, 15);
+        }
+      }
+    }
+
+    inv_qdct_chroma8x8_intra(trial.Cr, nonzero_mask_Cr);
+    inv_qdct_chroma8x8_intra(trial.Cb, nonzero_mask_Cb);
+    get_reconstruction(trial.Cr.data(), cr_candidate.data(), 64, 240);
+    get_reconstruction(trial.Cb.data(), cb_candidate.data(), 64, 240);
+    int cost = rd_ssd(mb.Cr.data(), trial.Cr.data(), 64) + rd_ssd(mb.Cb.data(), trial.Cb.data(), 64) + rd_lambda * bits;
+    if (cost < min_cost) {
+      min_cost = cost;
+      best_mode = static_cast<IntraChromaMode>(mode);
+      cr_pred = cr_candidate;
+      cb_pred = cb_candidate;
+    }
+  }
+
+  get_residual(mb.Cr.data(), mb.Cr.data(), cr_pred.data(), 64);
+  get_residual(mb.Cb.data(), mb.Cb.data(), cb_pred.data(), 64);
+
+  return std::make_tuple(min_cost, best_mode);
+}
+
 void encode_I_frame(Frame& frame) {
-  // decoded Y blocks for intra prediction
-  std::vector<MacroBlock> decoded_blocks;
+  // a duplicate comes coded from the frame cache
+  if (frame.is_duplicate())
+    return;
+
+  // decoded Y blocks for intra prediction, the rows taken from the cache come reconstructed
+  std::vector<MacroBlock> decoded_blocks(std::move(frame.decoded_blocks));
   decoded_blocks.reserve(frame.mbs.size());
 
-  int mb_no = 0;
-  for (auto& mb : frame.mbs) {
-    f_logger.log(Level::DEBUG, "mb #" + std::to_string(mb_no++));
+  for (std::size_t mb_no = decoded_blocks.size(); mb_no != frame.mbs.size(); mb_no++) {
+    MacroBlock& mb = frame.mbs[mb_no];
+    f_logger.log(Level::DEBUG, "mb #" + std::to_string(mb_no));
     decoded_blocks.push_back(mb);
     MacroBlock origin_block = mb;
 
@@ -31,6 +332,7 @@ void encode_I_frame(Frame& frame) {
     auto begin_enc_CbCr = std::chrono::high_resolution_clock::now();
     #endif
     int error_chroma = encode_Cr_Cb_block(mb, decoded_blocks, frame);
+    mb.set_coded_block_pattern();
     #ifdef EN_DBG_ENC_I_FRAME
     auto end_enc_CbCr = std::chrono::high_resolution_clock::now();
     auto dur_enc_CbCr = end_enc_CbCr - begin_enc_CbCr;
@@ -38,7 +340,10 @@ void encode_I_frame(Frame& frame) {
     printf("[DBG] encode_Cr_Cb_block cost %ld us\n", us_enc_CbCr);
     #endif
 
-    if (error_luma > 2000 || error_chroma > 1000) {
+    // I_PCM when the prediction is too poor, or with RD when the raw samples cost less
+    const bool pcm = rd_decision() ? error_luma + error_chroma > rd_lambda * rd_pcm_bits
+                                   : error_luma > 2000 || error_chroma > 1000;
+    if (pcm) {
       f_logger.log(Level::VERBOSE, "error exceeded: luma " + std::to_string(error_luma) + " chroma: " + std::to_string(error_chroma));
       mb = origin_block;
       decoded_blocks.back() = origin_block;
@@ -46,6 +351,10 @@ void encode_I_frame(Frame& frame) {
     }
   }
 
+  // the cache keeps the reconstruction before deblocking
+  if (FrameCache::enabled)
+    frame.decoded_blocks = decoded_blocks;
+
   // in-loop deblocking filter
   deblocking_filter(decoded_blocks, frame);
 }
@@ -75,9 +384,15 @@ void run_Y_intra4x4_predict(Worker_Y_intra4x4_encode_block *const args)
 }
 
 int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+  const bool try_intra4x4 = IntraSearch::intra4x4 != Intra4x4Search::OFF;
+
   // temp marcoblock for choosing two predicitons
-  MacroBlock temp_block = mb;
-  MacroBlock temp_decoded_block = mb;
+  MacroBlock temp_block(mb.mb_row, mb.mb_col);
+  MacroBlock temp_decoded_block(mb.mb_row, mb.mb_col);
+  if (try_intra4x4) {
+    temp_block = mb;
+    temp_decoded_block = mb;
+  }
 
 #ifndef TEST3_THREAD_IN_ENCODE_Y_INTRA16x16_BLOCK
   #ifdef EN_DBG_ENC_Y_INTRA_16x16
@@ -117,10 +432,23 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
   auto begin_4x4 = std::chrono::high_resolution_clock::now();
   #endif
 
-  // perform intra4x4 prediction
-  int error_intra4x4 = 0;
-  for (int i = 0; i != 16; i++)
-    error_intra4x4 += encode_Y_intra4x4_block(i, temp_block, temp_decoded_block, decoded_blocks, frame);
+#ifndef TEST3_THREAD_IN_ENCODE_Y_INTRA16x16_BLOCK
+  const bool skip_intra4x4 = !rd_decision() && error_intra16x16 <= intra4x4_min_error_16x16;
+  const int bound_intra4x4 = error_intra16x16;
+#else
+  // intra16x16 is still running, no early termination
+  const bool skip_intra4x4 = false;
+  const int bound_intra4x4 = std::numeric_limits<int>::max();
+#endif
+
+  // perform intra4x4 prediction, given up once it costs more than intra16x16
+  int error_intra4x4 = std::numeric_limits<int>::max();
+  if (try_intra4x4 && !skip_intra4x4) {
+    // with RD the one bit of mb_type I_NxN, coded_block_pattern is not counted
+    error_intra4x4 = rd_decision() ? rd_lambda * ue_bits(0) : 0;
+    for (int i = 0; i != 16 && error_intra4x4 < bound_intra4x4; i++)
+      error_intra4x4 += encode_Y_intra4x4_block(i, temp_block, temp_decoded_block, decoded_blocks, frame);
+  }
 
   #ifdef EN_DBG_ENC_Y_INTRA_4x4
   auto end_4x4 = std::chrono::high_resolution_clock::now();
@@ -207,7 +535,7 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
   Worker_Y_intra4x4_encode_block worker_Y_4x4_th0(0, &mb, &decoded_blocks, &frame, 0, 4);
   Worker_Y_intra4x4_encode_block worker_Y_4x4_th1(1, &mb, &decoded_blocks, &frame, 4, 4);
   Worker_Y_intra4x4_encode_block worker_Y_4x4_th2(2, &mb, &decoded_blocks, &frame, 8, 4);
-  Worker_Y_intra4x4_encode_block worker_Y_4x4_th3(2, &mb, &decoded_blocks, &frame, 12, 4);
+  Worker_Y_intra4x4_encode_block worker_Y_4x4_th3(3, &mb, &decoded_blocks, &frame, 12, 4);
 
   #ifdef EN_DBG_ENC_Y_INTRA_4x4
   auto begin_4x4 = std::chrono::high_resolution_clock::now();
@@ -239,6 +567,10 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
 
 #endif
 
+  // the workers encode copies of the macroblock that are thrown away,
+  // and each of them predicts from blocks the others have not decoded yet
+  error_intra4x4 = std::numeric_limits<int>::max();
+
 #endif
 
 
@@ -248,8 +580,7 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
 #endif
 
   // compare the error of two predictions
-  // if (error_intra4x4 < error_intra16x16) {
-  if (false && error_intra4x4 < error_intra16x16) {
+  if (try_intra4x4 && error_intra4x4 < error_intra16x16) {
     mb = temp_block;
     decoded_blocks.at(mb.mb_index) = temp_decoded_block;
     std::string mode = "\tmode:";
@@ -274,31 +605,30 @@ int encode_Y_intra16x16_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_b
       return std::experimental::optional<std::reference_wrapper<Block16x16>>(decoded_blocks.at(index).Y);
   };
 
-  // apply intra prediction
+  // apply intra prediction, the neighbors stay as they are until reconstruction
+  const Predictor predictor = get_intra16x16_predictor(get_decoded_Y_block(MB_NEIGHBOR_UL),
+                                                       get_decoded_Y_block(MB_NEIGHBOR_U),
+                                                       get_decoded_Y_block(MB_NEIGHBOR_L));
   int error;
   Intra16x16Mode mode;
-  std::tie(error, mode) = intra16x16(mb.Y, get_decoded_Y_block(MB_NEIGHBOR_UL),
-                                           get_decoded_Y_block(MB_NEIGHBOR_U),
-                                           get_decoded_Y_block(MB_NEIGHBOR_L));
+  Block16x16 pred;
+  if (rd_decision())
+    std::tie(error, mode) = intra16x16_rd(frame, mb, predictor, pred);
+  else
+    std::tie(error, mode) = intra16x16(mb.Y, predictor, pred);
 
   mb.is_intra16x16 = true;
   mb.intra16x16_Y_mode = mode;
 
-  // QDCT
-  qdct_luma16x16_intra(mb.Y);
-  
+  // QDCT, the mask comes back in raster order
+  int nonzero_mask = qdct_luma16x16_intra(mb.Y);
+  set_luma16x16_nonzero(mb, nonzero_mask);
+
   // reconstruct for later prediction
-  decoded_blocks.at(mb.mb_index).Y = mb.Y;
-  inv_qdct_luma16x16_intra(decoded_blocks.at(mb.mb_index).Y);
-  intra16x16_reconstruct(decoded_blocks.at(mb.mb_index).Y,
-                         get_decoded_Y_block(MB_NEIGHBOR_UL),
-                         get_decoded_Y_block(MB_NEIGHBOR_U),
-                         get_decoded_Y_block(MB_NEIGHBOR_L),
-                         mode);
-
-  for (int i = 0; i < 16; i++)
-    for (int j = 0; j < 16; j++)
-      decoded_blocks.at(mb.mb_index).Y[i*16+j] = std::max(16, std::min(235, decoded_blocks.at(mb.mb_index).Y[i*16+j]));
+  Block16x16& decoded_Y = decoded_blocks.at(mb.mb_index).Y;
+  decoded_Y = mb.Y;
+  inv_qdct_luma16x16_intra(decoded_Y, nonzero_mask);
+  intra16x16_reconstruct(decoded_Y, pred);
 
   return error;
 }
@@ -357,7 +687,7 @@ int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_blo
       pos = 0;
     } else if (0 <= temp_pos && temp_pos <= 2) {
       index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-      pos = 1 + temp_pos;
+      pos = 13 + temp_pos;
     } else if ((temp_pos + 1) % 4 == 0) {
       index = -1;
       pos = 0;
@@ -384,34 +714,39 @@ int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_blo
 
   int error = 0;
   Intra4x4Mode mode;
-  std::tie(error, mode) = intra4x4(mb.get_Y_4x4_block(cur_pos),
-                                   get_UL_4x4_block(),
-                                   get_U_4x4_block(),
-                                   get_UR_4x4_block(),
-                                   get_L_4x4_block());
-
+  // the fast search always tries the mode that is cheapest to signal, RD counts its bits
   mb.is_intra16x16 = false;
+  int most_probable = (IntraSearch::intra4x4 == Intra4x4Search::FAST || rd_decision()) ? frame.predict_intra4x4_mode(mb, cur_pos) : -1;
+  const Predictor predictor = get_intra4x4_predictor(get_UL_4x4_block(),
+                                                     get_U_4x4_block(),
+                                                     get_UR_4x4_block(),
+                                                     get_L_4x4_block());
+  CopyBlock4x4 pred;
+  if (rd_decision())
+    std::tie(error, mode) = intra4x4_rd(mb.get_Y_4x4_block(cur_pos), predictor, pred, most_probable, luma_nc(frame, mb, cur_pos));
+  else
+    std::tie(error, mode) = intra4x4(mb.get_Y_4x4_block(cur_pos), predictor, pred, most_probable);
+
   mb.intra4x4_Y_mode.at(cur_pos) = mode;
 
   // QDCT
-  qdct_luma4x4_intra(mb.get_Y_4x4_block(cur_pos));
-
-  // reconstruct for later prediction
-  auto temp_4x4 = decoded_block.get_Y_4x4_block(cur_pos);
-  auto temp_mb = mb.get_Y_4x4_block(cur_pos);
-  for (int i = 0; i != 16; i++)
-    temp_4x4[i] = temp_mb[i];
-  inv_qdct_luma4x4_intra(decoded_block.get_Y_4x4_block(cur_pos));
-  intra4x4_reconstruct(decoded_block.get_Y_4x4_block(cur_pos),
-                       get_UL_4x4_block(),
-                       get_U_4x4_block(),
-                       get_UR_4x4_block(),
-                       get_L_4x4_block(),
-                       mode);
-
-  for (int i = 0; i < 4; i++)
-    for (int j = 0; j < 4; j++)
-      decoded_block.get_Y_4x4_block(cur_pos)[i*4+j] = std::max(16, std::min(235, decoded_block.get_Y_4x4_block(cur_pos)[i*4+j]));
+  mb.nonzero_mask &= ~(NONZERO_LUMA_DC | (1 << cur_pos));
+  bool nonzero = qdct_luma4x4_intra(mb.get_Y_4x4_block(cur_pos));
+  if (nonzero)
+    mb.nonzero_mask |= 1 << cur_pos;
+
+  // reconstruct for later prediction, an empty block is its prediction,
+  // which never leaves [16, 235] in 4x4
+  Block4x4 temp_4x4 = decoded_block.get_Y_4x4_block(cur_pos);
+  if (nonzero) {
+    Block4x4 temp_mb = mb.get_Y_4x4_block(cur_pos);
+    for (int i = 0; i != 4; i++)
+      std::copy_n(temp_mb.row(i), 4, temp_4x4.row(i));
+    inv_qdct_luma4x4_intra(temp_4x4);
+    intra4x4_reconstruct(temp_4x4, pred);
+  } else {
+    temp_4x4.copy_from(pred.data());
+  }
 
   return error;
 }
@@ -452,45 +787,36 @@ int encode_Cr_Cb_intra8x8_block(MacroBlock& mb, std::vector<MacroBlock>& decoded
       return std::experimental::optional<std::reference_wrapper<Block8x8>>(decoded_blocks.at(index).Cb);
   };
 
+  const Predictor cr_predictor = get_intra8x8_chroma_predictor(get_decoded_Cr_block(MB_NEIGHBOR_UL),
+                                                               get_decoded_Cr_block(MB_NEIGHBOR_U),
+                                                               get_decoded_Cr_block(MB_NEIGHBOR_L));
+  const Predictor cb_predictor = get_intra8x8_chroma_predictor(get_decoded_Cb_block(MB_NEIGHBOR_UL),
+                                                               get_decoded_Cb_block(MB_NEIGHBOR_U),
+                                                               get_decoded_Cb_block(MB_NEIGHBOR_L));
   int error;
   IntraChromaMode mode;
-  std::tie(error, mode) = intra8x8_chroma(mb.Cr, get_decoded_Cr_block(MB_NEIGHBOR_UL),
-                                                 get_decoded_Cr_block(MB_NEIGHBOR_U),
-                                                 get_decoded_Cr_block(MB_NEIGHBOR_L),
-                                          mb.Cb, get_decoded_Cb_block(MB_NEIGHBOR_UL),
-                                                 get_decoded_Cb_block(MB_NEIGHBOR_U),
-                                                 get_decoded_Cb_block(MB_NEIGHBOR_L));
+  Block8x8 cr_pred, cb_pred;
+  if (rd_decision())
+    std::tie(error, mode) = intra8x8_chroma_rd(frame, mb, cr_predictor, cr_pred, cb_predictor, cb_pred);
+  else
+    std::tie(error, mode) = intra8x8_chroma(mb.Cr, cr_predictor, cr_pred, mb.Cb, cb_predictor, cb_pred);
 
   mb.intra_Cr_Cb_mode = mode;
 
   // QDCT
-  qdct_chroma8x8_intra(mb.Cr);
-  qdct_chroma8x8_intra(mb.Cb);
+  int nonzero_mask_Cr = qdct_chroma8x8_intra(mb.Cr);
+  int nonzero_mask_Cb = qdct_chroma8x8_intra(mb.Cb);
+  set_chroma_nonzero(mb, nonzero_mask_Cr, nonzero_mask_Cb);
 
   // reconstruct for later prediction
-  decoded_blocks.at(mb.mb_index).Cr = mb.Cr;
-  inv_qdct_chroma8x8_intra(decoded_blocks.at(mb.mb_index).Cr);
-  intra8x8_chroma_reconstruct(decoded_blocks.at(mb.mb_index).Cr,
-                              get_decoded_Cr_block(MB_NEIGHBOR_UL),
-                              get_decoded_Cr_block(MB_NEIGHBOR_U),
-                              get_decoded_Cr_block(MB_NEIGHBOR_L),
-                              mode);
-
-  for (int i = 0; i < 8; i++)
-    for (int j = 0; j < 8; j++)
-      decoded_blocks.at(mb.mb_index).Cr[i*8+j] = std::max(16, std::min(240, decoded_blocks.at(mb.mb_index).Cr[i*8+j]));
-
-  decoded_blocks.at(mb.mb_index).Cb = mb.Cb;
-  inv_qdct_chroma8x8_intra(decoded_blocks.at(mb.mb_index).Cb);
-  intra8x8_chroma_reconstruct(decoded_blocks.at(mb.mb_index).Cb,
-                              get_decoded_Cb_block(MB_NEIGHBOR_UL),
-                              get_decoded_Cb_block(MB_NEIGHBOR_U),
-                              get_decoded_Cb_block(MB_NEIGHBOR_L),
-                              mode);
-
-  for (int i = 0; i < 8; i++)
-    for (int j = 0; j < 8; j++)
-      decoded_blocks.at(mb.mb_index).Cb[i*8+j] = std::max(16, std::min(240, decoded_blocks.at(mb.mb_index).Cb[i*8+j]));
+  MacroBlock& decoded_block = decoded_blocks.at(mb.mb_index);
+  decoded_block.Cr = mb.Cr;
+  inv_qdct_chroma8x8_intra(decoded_block.Cr, nonzero_mask_Cr);
+  intra8x8_chroma_reconstruct(decoded_block.Cr, cr_pred);
+
+  decoded_block.Cb = mb.Cb;
+  inv_qdct_chroma8x8_intra(decoded_block.Cb, nonzero_mask_Cb);
+  intra8x8_chroma_reconstruct(decoded_block.Cb, cb_pred);
 
   return error;
 }
@@ -1,79 +1,112 @@
 #include "frame_vlc.h"
 
-void vlc_frame(Frame& frame) {
-  std::vector<std::array<int, 16>> nc_Y_table;
-  nc_Y_table.reserve(frame.mbs.size());
-  std::vector<std::array<int, 4>> nc_Cb_table;
-  nc_Cb_table.reserve(frame.mbs.size());
-  std::vector<std::array<int, 4>> nc_Cr_table;
-  nc_Cr_table.reserve(frame.mbs.size());
+static void fill_grid(std::vector<std::uint8_t>& grid, const int stride, const int rows) {
+  grid.assign(stride * rows, 0);
+  for (int x = 0; x != stride; x++)
+    grid[x] = NCContext::unavailable;
+  for (int y = 0; y != rows; y++)
+    grid[y * stride] = NCContext::unavailable;
+}
+
+void NCContext::reset(const Frame& frame) {
+  int stride = frame.nb_mb_cols * 4 + 1;
+  int rows = frame.nb_mb_rows * 4 + 1;
+  if (Y_stride == stride && Y.size() == static_cast<std::size_t>(stride * rows))
+    return;
+
+  // every block is written before its right and lower neighbours read it
+  Y_stride = stride;
+  fill_grid(Y, Y_stride, rows);
+  C_stride = frame.nb_mb_cols * 2 + 1;
+  fill_grid(Cb, C_stride, frame.nb_mb_rows * 2 + 1);
+  fill_grid(Cr, C_stride, frame.nb_mb_rows * 2 + 1);
+}
+
+/* nC from the left (nA) and the upper (nB) block
+ * an unavailable neighbour pushes the sum past 0x80 and drops out
+ */
+static inline int predict_nc(const std::uint8_t* nc, const int stride) {
+  int n = nc[-1] + nc[-stride];
+  return (n < NCContext::unavailable) ? (n + 1) >> 1 : n & (NCContext::unavailable - 1);
+}
+
+static inline int Y_offset(const int cur_pos, const int stride) {
+  int real_pos = MacroBlock::convert_table[cur_pos];
+  return (real_pos / 4) * stride + real_pos % 4;
+}
+
+void vlc_frame(Frame& frame, NCContext& nc) {
+  nc.reset(frame);
+
+  Bitstream& arena = frame.mb_bitstream;
+  arena.reserve(frame.mbs.size() * 64);
 
   // int mb_no = 0;
   for (auto& mb : frame.mbs) {
     // f_logger.log(Level::DEBUG, "mb #" + std::to_string(mb_no++));
-    std::array<int, 16> current_Y_table;
-    std::array<int, 4> current_Cb_table;
-    std::array<int, 4> current_Cr_table;
-    nc_Y_table.push_back(current_Y_table);
-    nc_Cb_table.push_back(current_Cb_table);
-    nc_Cr_table.push_back(current_Cr_table);
+    std::uint8_t* nc_Y = &nc.Y[(mb.mb_row * 4 + 1) * nc.Y_stride + mb.mb_col * 4 + 1];
+    std::uint8_t* nc_Cb = &nc.Cb[(mb.mb_row * 2 + 1) * nc.C_stride + mb.mb_col * 2 + 1];
+    std::uint8_t* nc_Cr = &nc.Cr[(mb.mb_row * 2 + 1) * nc.C_stride + mb.mb_col * 2 + 1];
 
     if (mb.is_I_PCM) {
-      for (int i = 0; i != 16; i++)
-        nc_Y_table.at(mb.mb_index)[i] = 16;
       for (int i = 0; i != 4; i++) {
-        nc_Cb_table.at(mb.mb_index)[i] = 16;
-        nc_Cr_table.at(mb.mb_index)[i] = 16;
+        for (int j = 0; j != 4; j++)
+          nc_Y[i * nc.Y_stride + j] = 16;
+      }
+      for (int i = 0; i != 4; i++) {
+        nc_Cb[(i / 2) * nc.C_stride + i % 2] = 16;
+        nc_Cr[(i / 2) * nc.C_stride + i % 2] = 16;
       }
 
       continue;
     }
 
+    // start every macroblock on a byte boundary of the arena
+    if (!arena.byte_align())
+      arena += Bitstream(static_cast<std::uint8_t>(0), 8 - arena.nb_bits % 8);
+    mb.bitstream_offset = arena.buffer.size();
+    int start_bits = arena.nb_bits;
+
     if (mb.is_intra16x16)
-      mb.bitstream += vlc_Y_DC(mb, nc_Y_table, frame);
-
-    std::array<Bitstream, 4> temp_luma;
-    for (int i = 0; i != 16; i++)
-      temp_luma[i / 4] += vlc_Y(i, mb, nc_Y_table, frame);
-    if (mb.is_intra16x16) {
-      if (mb.coded_block_pattern_luma)
-        for (int i = 0; i != 4; i++)
-          mb.bitstream += temp_luma[i];
-    } else {
-      for (int i = 0; i != 4; i++)
-        if (mb.coded_block_pattern_luma_4x4[i])
-          mb.bitstream += temp_luma[i];
+      arena += vlc_Y_DC(mb, nc_Y, nc.Y_stride);
+
+    // 8x8 groups left out by the coded_block_pattern are not coded at all
+    for (int i = 0; i != 16; i++) {
+      bool coded = mb.is_intra16x16 ? mb.coded_block_pattern_luma : mb.coded_block_pattern_luma_4x4[i / 4];
+      if (coded)
+        arena += vlc_Y(i, mb, nc_Y, nc.Y_stride);
+      else
+        nc_Y[Y_offset(i, nc.Y_stride)] = 0;
     }
 
-    Bitstream temp_chroma_DC;
-    Bitstream temp_chroma_AC;
-    temp_chroma_DC += vlc_Cb_DC(mb);
-    temp_chroma_DC += vlc_Cr_DC(mb);
-    for (int i = 0; i != 4; i++)
-      temp_chroma_AC += vlc_Cb_AC(i, mb, nc_Cb_table, frame);
-    for (int i = 0; i != 4; i++)
-      temp_chroma_AC += vlc_Cr_AC(i, mb, nc_Cr_table, frame);
-
-    if (mb.coded_block_pattern_chroma_DC || mb.coded_block_pattern_chroma_AC)
-      mb.bitstream += temp_chroma_DC;
-    if (mb.coded_block_pattern_chroma_AC)
-      mb.bitstream += temp_chroma_AC;
+    if (mb.coded_block_pattern_chroma_DC || mb.coded_block_pattern_chroma_AC) {
+      arena += vlc_Cb_DC(mb);
+      arena += vlc_Cr_DC(mb);
+    }
+    for (int i = 0; i != 4; i++) {
+      if (mb.coded_block_pattern_chroma_AC)
+        arena += vlc_Cb_AC(i, mb, nc_Cb, nc.C_stride);
+      else
+        nc_Cb[(i / 2) * nc.C_stride + i % 2] = 0;
+    }
+    for (int i = 0; i != 4; i++) {
+      if (mb.coded_block_pattern_chroma_AC)
+        arena += vlc_Cr_AC(i, mb, nc_Cr, nc.C_stride);
+      else
+        nc_Cr[(i / 2) * nc.C_stride + i % 2] = 0;
+    }
+
+    mb.bitstream_bits = arena.nb_bits - start_bits;
   }
 }
 
-Bitstream vlc_Y_DC(MacroBlock& mb, std::vector<std::array<int, 16>>& nc_Y_table, Frame& frame) {
-  int nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-  int nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-
-  int nC;
-  if (nA_index != -1 && nB_index != -1)
-    nC = (nc_Y_table.at(nA_index)[5] + nc_Y_table.at(nB_index)[10] + 1) >> 1;
-  else if (nA_index != -1)
-    nC = nc_Y_table.at(nA_index)[5];
-  else if (nB_index != -1)
-    nC = nc_Y_table.at(nB_index)[10];
-  else
-    nC = 0;
+/* the DC block shares nC with the top-left 4x4 block
+ */
+Bitstream vlc_Y_DC(MacroBlock& mb, const std::uint8_t* nc_Y, const int stride) {
+  int nC = predict_nc(nc_Y, stride);
+
+  if (!(mb.nonzero_mask & NONZERO_LUMA_DC))
+    return cavlc_empty_block(nC);
 
   Bitstream bitstream;
   int non_zero;
@@ -82,38 +115,14 @@ Bitstream vlc_Y_DC(MacroBlock& mb, std::vector<std::array<int, 16>>& nc_Y_table,
   return bitstream;
 }
 
-Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 16>>& nc_Y_table, Frame& frame) {
-  int real_pos = MacroBlock::convert_table[cur_pos];
+Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::uint8_t* nc_Y, const int stride) {
+  std::uint8_t* nc = nc_Y + Y_offset(cur_pos, stride);
+  int nC = predict_nc(nc, stride);
 
-  int nA_index, nA_pos;
-  if (real_pos % 4 == 0) {
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-    nA_pos = real_pos + 3;
-  } else {
-    nA_index = mb.mb_index;
-    nA_pos = real_pos - 1;
-  }
-  nA_pos = MacroBlock::convert_table[nA_pos];
-
-  int nB_index, nB_pos;
-  if (0 <= real_pos && real_pos <= 3) {
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-    nB_pos = 12 + real_pos;
-  } else {
-    nB_index = mb.mb_index;
-    nB_pos = real_pos - 4;
+  if (!(mb.nonzero_mask & (1 << cur_pos))) {
+    *nc = 0;
+    return cavlc_empty_block(nC);
   }
-  nB_pos = MacroBlock::convert_table[nB_pos];
-
-  int nC;
-  if (nA_index != -1 && nB_index != -1)
-    nC = (nc_Y_table.at(nA_index)[nA_pos] + nc_Y_table.at(nB_index)[nB_pos] + 1) >> 1;
-  else if (nA_index != -1)
-    nC = nc_Y_table.at(nA_index)[nA_pos];
-  else if (nB_index != -1)
-    nC = nc_Y_table.at(nB_index)[nB_pos];
-  else
-    nC = 0;
 
   Bitstream bitstream;
   int non_zero;
@@ -121,114 +130,63 @@ Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 16>>& n
     std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Y_AC_block(cur_pos), nC, 15);
   else
     std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Y_4x4_block(cur_pos), nC, 16);
-  nc_Y_table.at(mb.mb_index)[cur_pos] = non_zero;
-
-  if (non_zero != 0) {
-    mb.coded_block_pattern_luma = true;
-    mb.coded_block_pattern_luma_4x4[cur_pos / 4] = true;
-  }
+  *nc = non_zero;
 
   return bitstream;
 }
 
 Bitstream vlc_Cb_DC(MacroBlock& mb) {
+  if (!(mb.nonzero_mask & NONZERO_CB_DC))
+    return cavlc_empty_block(-1);
+
   Bitstream bitstream;
   int non_zero;
   std::tie(bitstream, non_zero) = cavlc_block2x2(mb.get_Cb_DC_block(), -1, 4);
 
-  if (non_zero != 0)
-    mb.coded_block_pattern_chroma_DC = true;
-
   return bitstream;
 }
 
 Bitstream vlc_Cr_DC(MacroBlock& mb) {
+  if (!(mb.nonzero_mask & NONZERO_CR_DC))
+    return cavlc_empty_block(-1);
+
   Bitstream bitstream;
   int non_zero;
   std::tie(bitstream, non_zero) = cavlc_block2x2(mb.get_Cr_DC_block(), -1, 4);
 
-  if (non_zero != 0)
-    mb.coded_block_pattern_chroma_DC = true;
-
   return bitstream;
 }
 
-Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>& nc_Cb_table, Frame& frame) {
-  int nA_index, nA_pos;
-  if (cur_pos % 2 == 0) {
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-    nA_pos = cur_pos + 1;
-  } else {
-    nA_index = mb.mb_index;
-    nA_pos = cur_pos - 1;
-  }
+Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::uint8_t* nc_Cb, const int stride) {
+  std::uint8_t* nc = nc_Cb + (cur_pos / 2) * stride + cur_pos % 2;
+  int nC = predict_nc(nc, stride);
 
-  int nB_index, nB_pos;
-  if (0 <= cur_pos && cur_pos <= 1) {
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-    nB_pos = cur_pos + 2;
-  } else {
-    nB_index = mb.mb_index;
-    nB_pos = cur_pos - 2;
+  if (!(mb.nonzero_mask & (1 << (NONZERO_CB_AC_SHIFT + cur_pos)))) {
+    *nc = 0;
+    return cavlc_empty_block(nC);
   }
 
-  int nC;
-  if (nA_index != -1 && nB_index != -1)
-    nC = (nc_Cb_table.at(nA_index)[nA_pos] + nc_Cb_table.at(nB_index)[nB_pos] + 1) >> 1;
-  else if (nA_index != -1)
-    nC = nc_Cb_table.at(nA_index)[nA_pos];
-  else if (nB_index != -1)
-    nC = nc_Cb_table.at(nB_index)[nB_pos];
-  else
-    nC = 0;
-
   Bitstream bitstream;
   int non_zero;
   std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cb_AC_block(cur_pos), nC, 15);
-  nc_Cb_table.at(mb.mb_index)[cur_pos] = non_zero;
-
-  if (non_zero != 0)
-    mb.coded_block_pattern_chroma_AC = true;
+  *nc = non_zero;
 
   return bitstream;
 }
 
-Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>& nc_Cr_table, Frame& frame) {
-  int nA_index, nA_pos;
-  if (cur_pos % 2 == 0) {
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-    nA_pos = cur_pos + 1;
-  } else {
-    nA_index = mb.mb_index;
-    nA_pos = cur_pos - 1;
-  }
+Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::uint8_t* nc_Cr, const int stride) {
+  std::uint8_t* nc = nc_Cr + (cur_pos / 2) * stride + cur_pos % 2;
+  int nC = predict_nc(nc, stride);
 
-  int nB_index, nB_pos;
-  if (0 <= cur_pos && cur_pos <= 1) {
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-    nB_pos = cur_pos + 2;
-  } else {
-    nB_index = mb.mb_index;
-    nB_pos = cur_pos - 2;
+  if (!(mb.nonzero_mask & (1 << (NONZERO_CR_AC_SHIFT + cur_pos)))) {
+    *nc = 0;
+    return cavlc_empty_block(nC);
   }
 
-  int nC;
-  if (nA_index != -1 && nB_index != -1)
-    nC = (nc_Cr_table.at(nA_index)[nA_pos] + nc_Cr_table.at(nB_index)[nB_pos] + 1) >> 1;
-  else if (nA_index != -1)
-    nC = nc_Cr_table.at(nA_index)[nA_pos];
-  else if (nB_index != -1)
-    nC = nc_Cr_table.at(nB_index)[nB_pos];
-  else
-    nC = 0;
-
   Bitstream bitstream;
   int non_zero;
   std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cr_AC_block(cur_pos), nC, 15);
-  nc_Cr_table.at(mb.mb_index)[cur_pos] = non_zero;
-
-  if (non_zero != 0)
-    mb.coded_block_pattern_chroma_AC = true;
+  *nc = non_zero;
 
   return bitstream;
 }
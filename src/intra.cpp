@@ -1,5 +1,8 @@
 #include <thread>
+#include <cstdint>
+#include <limits>
 #include "intra.h"
+#include "sad.h"
 #include "worker.h"
 #include <chrono>
 
@@ -10,113 +13,276 @@ T clip(const T& n, const T& lower, const T& upper) {
   return std::max(lower, std::min(n, upper));
 }
 
-/* Input iterators
- * return summation of absolute difference (SAD)
+Intra4x4Search IntraSearch::intra4x4 = Intra4x4Search::OFF;
+
+/* Directional 4x4 modes ordered by the angle of the edge they follow,
+ * 0 is horizontal, 90 vertical, y pointing down
+ */
+static const Intra4x4Mode intra4x4_directions[8] = {
+  Intra4x4Mode::HORIZONTAL,     //   0
+  Intra4x4Mode::HORIZONTALDOWN, //  26.6
+  Intra4x4Mode::DOWNRIGHT,      //  45
+  Intra4x4Mode::VERTICALRIGHT,  //  63.4
+  Intra4x4Mode::VERTICAL,       //  90
+  Intra4x4Mode::VERTICALLEFT,   // 116.6
+  Intra4x4Mode::DOWNLEFT,       // 135
+  Intra4x4Mode::HORIZONTALUP    // 153.4
+};
+
+/* The same directions at twice their angle, as (cos, sin) times 5
+ * doubling makes an edge and its reverse the same vector, and
+ * 26.57 degrees is atan(1 / 2), so 53.13 degrees is exactly (3, 4) / 5
+ */
+static const int intra4x4_direction_vectors[8][2] = {
+  { 5,  0}, { 3,  4}, { 0,  5}, {-3,  4}, {-5,  0}, {-3, -4}, { 0, -5}, { 3, -4}
+};
+
+/* Modes worth trying for a 4x4 block in the fast search, bit per mode
+ *
+ * DC, vertical, horizontal and the most probable mode always, plus the
+ * two directional modes around the dominant edge. The edge comes from
+ * the gradients of the block together with its top and left neighbours;
+ * a flat block adds no directional mode.
  */
-template<class InputIt1, class InputIt2, class OutputIt>
-int SAD(InputIt1 first1, InputIt1 last1, InputIt2 first2, OutputIt result) {
-  int sad = 0;
-  int diff;
-  while (first1 != last1) {
-    diff = (*first1++ - *first2++);
-    *result++ = diff;
-    sad += (diff > 0)? diff: -diff;
-  }
-  return sad;
+static unsigned int intra4x4_candidates(const CopyBlock4x4& block, const Predictor& predictor, const int most_probable) {
+  unsigned int modes = (1 << static_cast<int>(Intra4x4Mode::DC)) |
+                       (1 << static_cast<int>(Intra4x4Mode::VERTICAL)) |
+                       (1 << static_cast<int>(Intra4x4Mode::HORIZONTAL));
+  if (most_probable >= 0)
+    modes |= 1 << most_probable;
+
+  // the block with its top and left neighbours, a missing neighbour repeats
+  // the border of the block so that no gradient crosses it
+  const std::array<int, 33>& p = predictor.pred_pel;
+  int s[5][5];
+  for (int j = 0; j < 4; j++)
+    s[0][j + 1] = predictor.up_available ? p[1 + j] : block[j];
+  for (int i = 0; i < 4; i++) {
+    s[i + 1][0] = predictor.left_available ? p[9 + i] : block[i * 4];
+    for (int j = 0; j < 4; j++)
+      s[i + 1][j + 1] = block[i * 4 + j];
+  }
+
+  // structure tensor of the gradients
+  int sxx = 0, syy = 0, sxy = 0;
+  for (int i = 1; i < 5; i++) {
+    for (int j = 1; j < 5; j++) {
+      int gx = s[i][j] - s[i][j - 1];
+      int gy = s[i][j] - s[i - 1][j];
+      sxx += gx * gx;
+      syy += gy * gy;
+      sxy += gx * gy;
+    }
+  }
+
+  // too flat for the edge to matter
+  if (sxx + syy < 16 * 16)
+    return modes;
+
+  // the edge runs across the dominant gradient, at twice its angle it
+  // points opposite to (sxx - syy, 2 sxy)
+  const int ex = syy - sxx;
+  const int ey = -2 * sxy;
+
+  // the closest direction has the largest dot product, all vectors are as long
+  int nearest = 0;
+  int nearest_dot = intra4x4_direction_vectors[0][0] * ex + intra4x4_direction_vectors[0][1] * ey;
+  for (int i = 1; i < 8; i++) {
+    int dot = intra4x4_direction_vectors[i][0] * ex + intra4x4_direction_vectors[i][1] * ey;
+    if (dot > nearest_dot) {
+      nearest = i;
+      nearest_dot = dot;
+    }
+  }
+
+  // the second one is the neighbour on the side of the edge, by the sign of the cross product
+  int cross = intra4x4_direction_vectors[nearest][0] * ey - intra4x4_direction_vectors[nearest][1] * ex;
+  int second = (nearest + (cross >= 0 ? 1 : 7)) % 8;
+
+  modes |= 1 << static_cast<int>(intra4x4_directions[nearest]);
+  modes |= 1 << static_cast<int>(intra4x4_directions[second]);
+  return modes;
 }
 
-Intra4x4Mode g_best_mode_intra4x4[4][16];
-CopyBlock4x4 g_residual_intra4x4[4];
-int g_min_sad_intra4x4[4][16];
+/* Modes of a 4x4 block whose neighbours are available, bit per mode
+ */
+static unsigned int intra4x4_available(const Predictor& predictor) {
+  const bool up = predictor.up_available;
+  const bool left = predictor.left_available;
+  unsigned int modes = 1 << static_cast<int>(Intra4x4Mode::DC);
+  if (up)
+    modes |= 1 << static_cast<int>(Intra4x4Mode::VERTICAL);
+  if (left)
+    modes |= (1 << static_cast<int>(Intra4x4Mode::HORIZONTAL)) |
+             (1 << static_cast<int>(Intra4x4Mode::HORIZONTALUP));
+  if (up && predictor.up_right_available)
+    modes |= (1 << static_cast<int>(Intra4x4Mode::DOWNLEFT)) |
+             (1 << static_cast<int>(Intra4x4Mode::VERTICALLEFT));
+  if (up && left)
+    modes |= (1 << static_cast<int>(Intra4x4Mode::DOWNRIGHT)) |
+             (1 << static_cast<int>(Intra4x4Mode::VERTICALRIGHT)) |
+             (1 << static_cast<int>(Intra4x4Mode::HORIZONTALDOWN));
+  return modes;
+}
 
-void run_intra4x4_predict(Worker_Y_intra4x4_modes *const args)
-{
+static int intra4x4_dc_value(const Predictor& predictor) {
+  const std::array<int, 33>& p = predictor.pred_pel;
+  int s1 = 0, s2 = 0, s = 0;
+  int i;
 
-  int mode;
-  Intra4x4Mode best_mode = static_cast<Intra4x4Mode>(0);
-  CopyBlock4x4 pred;
-  int min_sad = (1 << 15), sad;
-  // Run all modes to get least residual
-//  printf("[DBG] th%d sizeof(Intra4x4Mode) %ld sizeof(CopyBlock4x4) %ld\n", args->threadId, sizeof(Intra4x4Mode), sizeof(CopyBlock4x4));
-  for (mode = args->predict_mode_start; mode < args->predict_mode_end; mode++) {
+  for (i = 1; i < 5; i++) {
+    s1 += p[i];
+  }
+
+  for (i = 9; i < 13; i++) {
+    s2 += p[i];
+  }
 
-    if ((!args->predictor->up_available   && (Intra4x4Mode::VERTICAL   == static_cast<Intra4x4Mode>(mode))) ||
-        (!args->predictor->left_available && (Intra4x4Mode::HORIZONTAL == static_cast<Intra4x4Mode>(mode))) ||
-        ((!args->predictor->up_available || !args->predictor->up_right_available) && (Intra4x4Mode::DOWNLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!args->predictor->up_available || !args->predictor->left_available) && (Intra4x4Mode::DOWNRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!args->predictor->up_available || !args->predictor->left_available) && (Intra4x4Mode::VERTICALRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!args->predictor->up_available || !args->predictor->left_available) && (Intra4x4Mode::HORIZONTALDOWN == static_cast<Intra4x4Mode>(mode))) ||
-        ((!args->predictor->up_available || !args->predictor->up_right_available) && (Intra4x4Mode::VERTICALLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        (!args->predictor->left_available && (Intra4x4Mode::HORIZONTALUP == static_cast<Intra4x4Mode>(mode)))) {
+  if (predictor.up_available && predictor.left_available) {
+    s = s1 + s2;
+  }
+  else if (!predictor.up_available && predictor.left_available) {
+    s = 2 * s2;
+  }
+  else if (predictor.up_available && !predictor.left_available) {
+    s = 2 * s1;
+  }
+
+  s += 4;
+  s >>= 3;
+
+  if (!predictor.up_available && !predictor.left_available) {
+    s = 128;
+  }
+  return s;
+}
+
+/* Every intra4x4 prediction sample is taken from a table of
+ *   [0..12]   the edge: left column bottom up, corner, up and up-right row
+ *   [13..25]  the edge through (a + 2b + c + 2) >> 2, the two ends
+ *             through (a + 3b + 2) >> 2
+ *   [26..37]  (a + b + 1) >> 1 of two adjacent edge samples
+ *   [38]      DC
+ * intra4x4_taps[ mode ][ raster position ] indexes that table
+ */
+static const std::uint8_t intra4x4_taps[9][16] = {
+  { 5,  6,  7,  8,  5,  6,  7,  8,  5,  6,  7,  8,  5,  6,  7,  8},  // vertical
+  { 3,  3,  3,  3,  2,  2,  2,  2,  1,  1,  1,  1,  0,  0,  0,  0},  // horizontal
+  {38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38},  // DC
+  {19, 20, 21, 22, 20, 21, 22, 23, 21, 22, 23, 24, 22, 23, 24, 25},  // down left
+  {17, 18, 19, 20, 16, 17, 18, 19, 15, 16, 17, 18, 14, 15, 16, 17},  // down right
+  {30, 31, 32, 33, 17, 18, 19, 20, 16, 30, 31, 32, 15, 17, 18, 19},  // vertical right
+  {29, 17, 18, 19, 28, 16, 29, 17, 27, 15, 28, 16, 26, 14, 27, 15},  // horizontal down
+  {31, 32, 33, 34, 19, 20, 21, 22, 32, 33, 34, 35, 20, 21, 22, 23},  // vertical left
+  {28, 15, 27, 14, 27, 14, 26, 13, 26, 13,  0,  0,  0,  0,  0,  0}   // horizontal up
+};
+
+/* Batched intra4x4 search
+ *
+ * The filtered edge is computed once for all modes, each candidate in
+ * modes is then a gather from it followed by its cost. Ties keep the
+ * lower mode like the mode by mode search. Writes the prediction of the
+ * best mode on pred, returns its cost.
+ */
+static int intra4x4_best_mode(const int* original, const Predictor& predictor, const unsigned int modes,
+                              CopyBlock4x4& pred, Intra4x4Mode& best_mode) {
+  const std::array<int, 33>& p = predictor.pred_pel;
+  int taps[39];
+  int* edge = taps;
+  int* tap3 = taps + 13;
+  int* tap2 = taps + 26;
+
+  for (int i = 0; i < 4; i++)
+    edge[i] = p[12 - i];
+  for (int i = 0; i < 9; i++)
+    edge[4 + i] = p[i];
+
+  tap3[0] = (3 * edge[0] + edge[1] + 2) >> 2;
+  for (int i = 1; i < 12; i++)
+    tap3[i] = (edge[i - 1] + 2 * edge[i] + edge[i + 1] + 2) >> 2;
+  tap3[12] = (edge[11] + 3 * edge[12] + 2) >> 2;
+  for (int i = 0; i < 12; i++)
+    tap2[i] = (edge[i] + edge[i + 1] + 1) >> 1;
+  taps[38] = intra4x4_dc_value(predictor);
+
+  CopyBlock4x4 cand[2];
+  int cur = 0, best = 0;
+  int min_cost = (1 << 15);
+  best_mode = static_cast<Intra4x4Mode>(0);
+  for (int mode = 0; mode < 9; mode++) {
+    if (!(modes & (1 << mode)))
       continue;
-    }
 
-    get_intra4x4(pred, *(args->predictor), static_cast<Intra4x4Mode>(mode));
+    for (int i = 0; i < 16; i++)
+      cand[cur][i] = taps[intra4x4_taps[mode][i]];
 
-    sad = SAD(args->block->begin(), args->block->end(), pred.begin(), pred.begin());
-    if (sad < min_sad) {
-      min_sad = sad;
+    int cost = mode_cost4x4(original, cand[cur].data());
+    if (cost < min_cost) {
+      min_cost = cost;
       best_mode = static_cast<Intra4x4Mode>(mode);
-      std::copy(pred.begin(), pred.end(), g_residual_intra4x4[args->threadId].begin());
+      best = cur;
+      cur ^= 1;
     }
   }
 
+  pred = cand[best];
+  return min_cost;
+}
+
+Intra4x4Mode g_best_mode_intra4x4[4][16];
+CopyBlock4x4 g_residual_intra4x4[4];
+int g_min_sad_intra4x4[4][16];
+
+void run_intra4x4_predict(Worker_Y_intra4x4_modes *const args)
+{
+  Intra4x4Mode best_mode;
+  CopyBlock4x4 block, pred;
+  args->block->copy_to(block.data());
+
+  // the modes of this thread, searched like the single-threaded path
+  const unsigned int modes = ((1 << args->predict_mode_end) - 1) & ~((1 << args->predict_mode_start) - 1);
+  int min_sad = intra4x4_best_mode(block.data(), *(args->predictor), modes & intra4x4_available(*(args->predictor)),
+                                   pred, best_mode);
+
+  get_residual(g_residual_intra4x4[args->threadId].data(), block.data(), pred.data(), 16);
 
   g_best_mode_intra4x4[args->threadId][0] = best_mode;
   g_min_sad_intra4x4[args->threadId][0] = min_sad;
 
 }
 
-/* Input 4x4 block and its neighbors
- * do intra4x4 prediction which has 9 modes
- * overwrite residual on input block
- * return the least cost mode
+/* Modes the 4x4 search tries on a block, bit per mode
+ * the available ones, pre-selected with Intra4x4Search::FAST
  */
-std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
-  std::experimental::optional<Block4x4> ul,
-  std::experimental::optional<Block4x4> u,
-  std::experimental::optional<Block4x4> ur,
-  std::experimental::optional<Block4x4> l) {
+unsigned int intra4x4_search_modes(const CopyBlock4x4& block, const Predictor& predictor, const int most_probable) {
+  unsigned int modes = intra4x4_available(predictor);
+  if (IntraSearch::intra4x4 == Intra4x4Search::FAST)
+    modes &= intra4x4_candidates(block, predictor, most_probable);
+  return modes;
+}
 
-  // Get predictors
-//  Predictor predictor = get_intra4x4_predictor(ul, u, ur, l);
+/* Input 4x4 block and the predictor of its neighbors
+ * do intra4x4 prediction which has 9 modes, or only the pre-selected
+ * ones with Intra4x4Search::FAST, most_probable is the predicted mode
+ * overwrite residual on input block, the prediction on pred
+ * return the least cost mode
+ */
+std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block, const Predictor& predictor, CopyBlock4x4& pred,
+                                       const int most_probable) {
 
 #ifndef TEST2_THREAD_IN_Y_INTRA_4x4
-  // Get predictors
-  Predictor predictor = get_intra4x4_predictor(ul, u, ur, l);
+  Intra4x4Mode best_mode;
+  CopyBlock4x4 original;
+  block.copy_to(original.data());
 
-  int mode;
-  Intra4x4Mode best_mode = static_cast<Intra4x4Mode>(0);
-  CopyBlock4x4 pred, residual;
+  const unsigned int modes = intra4x4_search_modes(original, predictor, most_probable);
 
   #ifdef EN_DBG_INTRA_MODES_4x4
   auto begin_intra4x4 = std::chrono::high_resolution_clock::now();
   #endif
 
-  int min_sad = (1 << 15), sad;
-  // Run all modes to get least residual
-  for (mode = 0; mode < 9; mode++) {
-
-    if ((!predictor.up_available   && (Intra4x4Mode::VERTICAL   == static_cast<Intra4x4Mode>(mode))) ||
-        (!predictor.left_available && (Intra4x4Mode::HORIZONTAL == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.up_right_available) && (Intra4x4Mode::DOWNLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::DOWNRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::VERTICALRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::HORIZONTALDOWN == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.up_right_available) && (Intra4x4Mode::VERTICALLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        (!predictor.left_available && (Intra4x4Mode::HORIZONTALUP == static_cast<Intra4x4Mode>(mode)))) {
-      continue;
-    }
-
-    get_intra4x4(pred, predictor, static_cast<Intra4x4Mode>(mode));
-
-    sad = SAD(block.begin(), block.end(), pred.begin(), pred.begin());
-    if (sad < min_sad) {
-      min_sad = sad;
-      best_mode = static_cast<Intra4x4Mode>(mode);
-      std::copy(pred.begin(), pred.end(), residual.begin());
-    }
-  }
+  // all candidate modes in one pass
+  int min_sad = intra4x4_best_mode(original.data(), predictor, modes, pred, best_mode);
 
   #ifdef EN_DBG_INTRA_MODES_4x4
   auto end_intra4x4 = std::chrono::high_resolution_clock::now();
@@ -125,17 +291,17 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   printf("[DBG] intra4x4 cost %ld us\n", us_intra4x4);
   #endif
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = residual[i];
-  }
+  // the I_PCM fallback thresholds are in SAD
+  if (ModeCost::metric != CostMetric::ABS_DIFF)
+    min_sad = sad4x4(original.data(), pred.data());
+
+  get_residual(original.data(), original.data(), pred.data(), 16);
+  block.copy_from(original.data());
 
   return std::make_tuple(min_sad, best_mode);
 #else
   int min_thread;
 #if (MAX_THREADS == 1)
-  Predictor predictor = get_intra4x4_predictor(ul, u, ur, l);
-
   Worker_Y_intra4x4_modes worker_Y_4x4_modes;
   worker_Y_4x4_modes.threadId = 0;
   worker_Y_4x4_modes.predict_mode_start = 0;
@@ -146,14 +312,9 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   run_intra4x4_predict(&worker_Y_4x4_modes);
   min_thread = 0;
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = g_residual_intra4x4[min_thread][i];
-  }
+  block.copy_from(g_residual_intra4x4[min_thread].data());
 
 #elif (MAX_THREADS == 2)
-  Predictor predictor0 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor1 = get_intra4x4_predictor(ul, u, ur, l);
 
   Worker_Y_intra4x4_modes worker_Y_4x4_modes[2];
   std::thread workers;
@@ -161,13 +322,13 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   worker_Y_4x4_modes[0].threadId = 0;
   worker_Y_4x4_modes[0].predict_mode_start = 0;
   worker_Y_4x4_modes[0].predict_mode_end = 5;
-  worker_Y_4x4_modes[0].predictor = &predictor0;
+  worker_Y_4x4_modes[0].predictor = &predictor;
   worker_Y_4x4_modes[0].block = &block;
 
   worker_Y_4x4_modes[1].threadId = 1;
   worker_Y_4x4_modes[1].predict_mode_start = 5;
   worker_Y_4x4_modes[1].predict_mode_end = 9;
-  worker_Y_4x4_modes[1].predictor = &predictor1;
+  worker_Y_4x4_modes[1].predictor = &predictor;
   worker_Y_4x4_modes[1].block = &block;
 
   #ifdef EN_DBG_INTRA_MODES_4x4
@@ -195,15 +356,9 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
     min_thread = 1;
   }
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = g_residual_intra4x4[min_thread][i];
-  }
+  block.copy_from(g_residual_intra4x4[min_thread].data());
 
 #elif (MAX_THREADS == 3)
-  Predictor predictor0 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor1 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor2 = get_intra4x4_predictor(ul, u, ur, l);
 
   Worker_Y_intra4x4_modes worker_Y_4x4_modes[3];
   std::thread workers[2];
@@ -211,19 +366,19 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   worker_Y_4x4_modes[0].threadId = 0;
   worker_Y_4x4_modes[0].predict_mode_start = 0;
   worker_Y_4x4_modes[0].predict_mode_end = 3;
-  worker_Y_4x4_modes[0].predictor = &predictor0;
+  worker_Y_4x4_modes[0].predictor = &predictor;
   worker_Y_4x4_modes[0].block = &block;
 
   worker_Y_4x4_modes[1].threadId = 1;
   worker_Y_4x4_modes[1].predict_mode_start = 3;
   worker_Y_4x4_modes[1].predict_mode_end = 6;
-  worker_Y_4x4_modes[1].predictor = &predictor1;
+  worker_Y_4x4_modes[1].predictor = &predictor;
   worker_Y_4x4_modes[1].block = &block;
 
   worker_Y_4x4_modes[2].threadId = 2;
   worker_Y_4x4_modes[2].predict_mode_start = 6;
   worker_Y_4x4_modes[2].predict_mode_end = 9;
-  worker_Y_4x4_modes[2].predictor = &predictor2;
+  worker_Y_4x4_modes[2].predictor = &predictor;
   worker_Y_4x4_modes[2].block = &block;
 
   #ifdef EN_DBG_INTRA_MODES_4x4
@@ -256,16 +411,9 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   }
  
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = g_residual_intra4x4[min_thread][i];
-  }
+  block.copy_from(g_residual_intra4x4[min_thread].data());
 
 #elif (MAX_THREADS == 4)
-  Predictor predictor0 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor1 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor2 = get_intra4x4_predictor(ul, u, ur, l);
-  Predictor predictor3 = get_intra4x4_predictor(ul, u, ur, l);
 
   Worker_Y_intra4x4_modes worker_Y_4x4_modes[4];
   std::thread workers[3];
@@ -273,25 +421,25 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   worker_Y_4x4_modes[0].threadId = 0;
   worker_Y_4x4_modes[0].predict_mode_start = 0;
   worker_Y_4x4_modes[0].predict_mode_end = 3;
-  worker_Y_4x4_modes[0].predictor = &predictor0;
+  worker_Y_4x4_modes[0].predictor = &predictor;
   worker_Y_4x4_modes[0].block = &block;
 
   worker_Y_4x4_modes[1].threadId = 1;
   worker_Y_4x4_modes[1].predict_mode_start = 3;
   worker_Y_4x4_modes[1].predict_mode_end = 5;
-  worker_Y_4x4_modes[1].predictor = &predictor1;
+  worker_Y_4x4_modes[1].predictor = &predictor;
   worker_Y_4x4_modes[1].block = &block;
 
   worker_Y_4x4_modes[2].threadId = 2;
   worker_Y_4x4_modes[2].predict_mode_start = 5;
   worker_Y_4x4_modes[2].predict_mode_end = 7;
-  worker_Y_4x4_modes[2].predictor = &predictor2;
+  worker_Y_4x4_modes[2].predictor = &predictor;
   worker_Y_4x4_modes[2].block = &block;
 
   worker_Y_4x4_modes[3].threadId = 3;
   worker_Y_4x4_modes[3].predict_mode_start = 7;
   worker_Y_4x4_modes[3].predict_mode_end = 9;
-  worker_Y_4x4_modes[3].predictor = &predictor3;
+  worker_Y_4x4_modes[3].predictor = &predictor;
   worker_Y_4x4_modes[3].block = &block;
 
   #ifdef EN_DBG_INTRA_MODES_4x4
@@ -329,35 +477,22 @@ std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block,
   }
  
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = g_residual_intra4x4[min_thread][i];
-  }
+  block.copy_from(g_residual_intra4x4[min_thread].data());
 
 #endif
 
+  get_intra4x4(pred, predictor, g_best_mode_intra4x4[min_thread][0]);
+
   return std::make_tuple(g_min_sad_intra4x4[min_thread][0], g_best_mode_intra4x4[min_thread][0]);
 #endif
 }
 
-/* Input residual, neighbors and prediction mode
- * overwrite reconstructed block on resudual
+/* Input residual and the prediction of the chosen mode
+ * overwrite the reconstructed block, clipped to [16, 235], on the residual
  */
-void intra4x4_reconstruct(Block4x4 block,
-  std::experimental::optional<Block4x4> ul,
-  std::experimental::optional<Block4x4> u,
-  std::experimental::optional<Block4x4> ur,
-  std::experimental::optional<Block4x4> l,
-  const Intra4x4Mode mode) {
-
-  CopyBlock4x4 pred;
-  Predictor predictor = get_intra4x4_predictor(ul, u, ur, l);
-  get_intra4x4(pred, predictor, mode);
-
-  // std::transform(block.begin(), block.end(), pred.begin(), block.begin(), std::plus<int>());
-  for (int i = 0; i < 16; i++) {
-    block[i] += pred[i];
-  }
+void intra4x4_reconstruct(Block4x4 block, const CopyBlock4x4& pred) {
+  for (int y = 0; y < 4; y++)
+    get_reconstruction(block.row(y), pred.data() + y * 4, 4, 235);
 }
 
 /* Input predictors and mode
@@ -396,7 +531,7 @@ void get_intra4x4(CopyBlock4x4& pred, const Predictor& p, const Intra4x4Mode mod
 }
 
 void intra4x4_vertical(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i;
   for (i = 0; i < 4; i++) {
     std::copy_n(p.begin()+1, 4, pred.begin()+i*4);
@@ -404,7 +539,7 @@ void intra4x4_vertical(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_horizontal(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i, j;
   for (i = 0; i < 4; i++) {
     for (j = 0; j < 4; j++) {
@@ -414,40 +549,11 @@ void intra4x4_horizontal(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_dc(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int s1 = 0, s2 = 0, s = 0;
-  int i;
-
-  for (i = 1; i < 5; i++) {
-    s1 += p[i];
-  }
-
-  for (i = 9; i < 13; i++) {
-    s2 += p[i];
-  }
-
-  if (predictor.up_available && predictor.left_available) {
-    s = s1 + s2;
-  }
-  else if (!predictor.up_available && predictor.left_available) {
-    s = 2 * s2;
-  }
-  else if (predictor.up_available && !predictor.left_available) {
-    s = 2 * s1;
-  }
-
-  s += 4;
-  s >>= 3;
-
-  if (!predictor.up_available && !predictor.left_available) {
-    s = 128;
-  }
-
-  pred.fill(s);
+  pred.fill(intra4x4_dc_value(predictor));
 }
 
 void intra4x4_downleft(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   // x + y = 0
   pred[0]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
@@ -466,7 +572,7 @@ void intra4x4_downleft(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_downright(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   // x < y
   // y - x = 3
@@ -474,20 +580,20 @@ void intra4x4_downright(CopyBlock4x4& pred, const Predictor& predictor) {
   // y - x = 2
   pred[8]  = pred[13] = ((p[11] + p[9] + (p[10] << 1) + 2) >> 2);
   // y - x = 1
-  pred[4]  = pred[9]  = pred[14] = ((p[10] + p[1] + (p[9] << 1) + 2) >> 2);
+  pred[4]  = pred[9]  = pred[14] = ((p[0] + p[10] + (p[9] << 1) + 2) >> 2);
   // x = y
-  pred[0]  = pred[5]  = pred[10] = pred[15] = ((p[0] + p[9] + (p[1] << 1) + 2) >> 2);
+  pred[0]  = pred[5]  = pred[10] = pred[15] = ((p[1] + p[9] + (p[0] << 1) + 2) >> 2);
   // x > y
   // x - y = 1
   pred[1]  = pred[6]  = pred[11] = ((p[0] + p[2] + (p[1] << 1) + 2) >> 2);
   // x - y = 2
   pred[2]  = pred[7]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
   // x - y = 3
-  pred[3]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
+  pred[3]  = ((p[2] + p[4] + (p[3] << 1) + 2) >> 2);
 }
 
 void intra4x4_verticalright(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   // zVR = 2 * x - y
   // zVR = 0
@@ -513,7 +619,7 @@ void intra4x4_verticalright(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_horizontaldown(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   // zHD = 2 * y - x
   // zHD = 0
@@ -527,7 +633,7 @@ void intra4x4_horizontaldown(CopyBlock4x4& pred, const Predictor& predictor) {
   // zHD = 2
   pred[4]  = pred[10] = ((p[9] + p[10] + 1) >> 1);
   // zHD = 1
-  pred[5]  = pred[11] = ((p[0] + p[11] + (p[10] << 1) + 2) >> 2);
+  pred[5]  = pred[11] = ((p[0] + p[10] + (p[9] << 1) + 2) >> 2);
   // zHD = 4
   pred[8]  = pred[14] = ((p[10] + p[11] + 1) >> 1);
   // zHD = 3
@@ -539,7 +645,7 @@ void intra4x4_horizontaldown(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_verticalleft(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   pred[0]  = ((p[1] + p[2] + 1) >> 1);
   pred[1]  = pred[8]  = ((p[2] + p[3] + 1) >> 1);
@@ -554,7 +660,7 @@ void intra4x4_verticalleft(CopyBlock4x4& pred, const Predictor& predictor) {
 }
 
 void intra4x4_horizontalup(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   // hard code for speed
   // zHU = x + 2 * y
   // zHU = 0
@@ -586,12 +692,11 @@ Predictor get_intra4x4_predictor(
   std::experimental::optional<Block4x4> ur,
   std::experimental::optional<Block4x4> l) {
 
-  Predictor predictor(4);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor predictor;
+  std::array<int, 33>& p = predictor.pred_pel;
   // Check whether neighbors are available
   if (u) {
-    Block4x4& tmp = *u;
-    std::copy_n(tmp.begin()+4*3, 4, p.begin()+1);
+    std::copy_n(u->row(3), 4, p.begin()+1);
     predictor.up_available = true;
   }
   else {
@@ -599,8 +704,7 @@ Predictor get_intra4x4_predictor(
   }
 
   if (ur) {
-    Block4x4& tmp = *ur;
-    std::copy_n(tmp.begin()+4*3, 4, p.begin()+5);
+    std::copy_n(ur->row(3), 4, p.begin()+5);
     predictor.up_right_available = true;
   }
   else {
@@ -608,9 +712,8 @@ Predictor get_intra4x4_predictor(
   }
 
   if (l) {
-    Block4x4& tmp = *l;
     for (int i = 0; i < 4; i++) {
-      p[9+i] = tmp[i*4+3];
+      p[9+i] = (*l)(i, 3);
     }
     predictor.left_available = true;
   }
@@ -619,8 +722,7 @@ Predictor get_intra4x4_predictor(
   }
 
   if (predictor.up_available && predictor.left_available) {
-    Block4x4& tmp = *ul;
-    p[0] = tmp[15];
+    p[0] = (*ul)(3, 3);
     predictor.all_available = true;
   }
   else {
@@ -639,8 +741,9 @@ void run_intra16x16_predict(Worker_Y_intra16x16_modes *const args)
   
   int mode;
   Intra16x16Mode best_mode = static_cast<Intra16x16Mode>(0);
-  Block16x16 pred;
-  int min_sad = (1 << 15), sad;
+  Block16x16 pred[2];
+  int cur = 0, best = 0;
+  int min_sad = std::numeric_limits<int>::max(), sad;
 //  printf("[DBG] th%d\n", args->threadId);
   // Run all modes to get least residual
   for (mode = args->predict_mode_start; mode < args->predict_mode_end; mode++) {
@@ -651,40 +754,38 @@ void run_intra16x16_predict(Worker_Y_intra16x16_modes *const args)
       continue;
     }
 
-    get_intra16x16(pred, *(args->predictor), static_cast<Intra16x16Mode>(mode));
+    get_intra16x16(pred[cur], *(args->predictor), static_cast<Intra16x16Mode>(mode));
 
-    sad = SAD(args->block->begin(), args->block->end(), pred.begin(), pred.begin());
+    sad = mode_cost16x16(args->block->data(), pred[cur].data());
     if (sad < min_sad) {
       min_sad = sad;
       best_mode = static_cast<Intra16x16Mode>(mode);
-      std::copy(pred.begin(), pred.end(), g_residual_intra16x16[args->threadId].begin());
+      best = cur;
+      cur ^= 1;
     }
   }
 
+  get_residual(g_residual_intra16x16[args->threadId].data(), args->block->data(), pred[best].data(), 256);
+
   g_best_mode_intra16x16[args->threadId][0] = best_mode;
   g_min_sad_intra16x16[args->threadId][0] = min_sad;
   
 }
 
 
-/* Input 16x16 block and its neighbors
+/* Input 16x16 block and the predictor of its neighbors
  * do intra16x16 prediction which has 4 modes
- * overwrite residual on input block
+ * overwrite residual on input block, the prediction on pred
  * return the least cost mode
  */
-std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> ul,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> u,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> l) {
-
-  // Get predictors
-  Predictor predictor = get_intra16x16_predictor(ul, u, l);
-
+std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block, const Predictor& predictor, Block16x16& pred) {
 #ifndef TEST1_THREAD_IN_Y_INTRA_16x16
   int mode;
   Intra16x16Mode best_mode = static_cast<Intra16x16Mode>(0);
-  Block16x16 pred, residual;
-  int min_sad = (1 << 15), sad;
+  Block16x16 candidate;
+  Block16x16* cur = &candidate;
+  Block16x16* best = &pred;
+  int min_sad = std::numeric_limits<int>::max(), sad;
 
   #ifdef EN_DBG_INTRA_MODES_16x16
   auto begin_intra16x16 = std::chrono::high_resolution_clock::now();
@@ -699,13 +800,14 @@ std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block,
       continue;
     }
 
-    get_intra16x16(pred, predictor, static_cast<Intra16x16Mode>(mode));
+    get_intra16x16(*cur, predictor, static_cast<Intra16x16Mode>(mode));
 
-    sad = SAD(block.begin(), block.end(), pred.begin(), pred.begin());
+    // candidates only keep their prediction, two buffers are enough
+    sad = mode_cost16x16(block.data(), cur->data());
     if (sad < min_sad) {
       min_sad = sad;
       best_mode = static_cast<Intra16x16Mode>(mode);
-      std::copy(pred.begin(), pred.end(), residual.begin());
+      std::swap(cur, best);
     }
   }
 
@@ -716,7 +818,14 @@ std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block,
   printf("[DBG] intra16x16 cost %ld us\n", us_intra16x16);
   #endif
 
-  std::copy(residual.begin(), residual.end(), block.begin());
+  // the I_PCM fallback thresholds are in SAD
+  if (ModeCost::metric != CostMetric::ABS_DIFF)
+    min_sad = sad16x16(block.data(), best->data());
+
+  // the winning prediction is kept for the reconstruction
+  if (best != &pred)
+    pred = *best;
+  get_residual(block.data(), block.data(), pred.data(), 256);
 
   return std::make_tuple(min_sad, best_mode);
 #else
@@ -887,25 +996,17 @@ std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block,
 
 
   std::copy(g_residual_intra16x16[min_thread].begin(), g_residual_intra16x16[min_thread].end(), block.begin());
+  get_intra16x16(pred, predictor, g_best_mode_intra16x16[min_thread][0]);
 
   return std::make_tuple(g_min_sad_intra16x16[min_thread][0], g_best_mode_intra16x16[min_thread][0]);
 #endif // end of TEST1_THREAD_IN_Y_INTRA_16x16
 }
 
-/* Input residual, neighbors and prediction mode
- * overwrite reconstructed block on resudual
+/* Input residual and the prediction of the chosen mode
+ * overwrite the reconstructed block, clipped to [16, 235], on the residual
  */
-void intra16x16_reconstruct(Block16x16& block,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> ul,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> u,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> l,
-  const Intra16x16Mode mode) {
-
-  Block16x16 pred;
-  Predictor predictor = get_intra16x16_predictor(ul, u, l);
-  get_intra16x16(pred, predictor, mode);
-
-  std::transform(block.begin(), block.end(), pred.begin(), block.begin(), std::plus<int>());
+void intra16x16_reconstruct(Block16x16& block, const Block16x16& pred) {
+  get_reconstruction(block.data(), pred.data(), 256, 235);
 }
 
 /* Input predictors and mode
@@ -929,7 +1030,7 @@ void get_intra16x16(Block16x16& pred, const Predictor& p, const Intra16x16Mode m
 }
 
 void intra16x16_vertical(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i;
   for (i = 0; i < 16; i++) {
     std::copy_n(p.begin()+1, 16, pred.begin()+i*16);
@@ -937,7 +1038,7 @@ void intra16x16_vertical(Block16x16& pred, const Predictor& predictor) {
 }
 
 void intra16x16_horizontal(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i, j;
   for (i = 0; i < 16; i++) {
     for (j = 0; j < 16; j++) {
@@ -947,7 +1048,7 @@ void intra16x16_horizontal(Block16x16& pred, const Predictor& predictor) {
 }
 
 void intra16x16_dc(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int s1 = 0, s2 = 0, s = 0;
   int i;
 
@@ -980,7 +1081,7 @@ void intra16x16_dc(Block16x16& pred, const Predictor& predictor) {
 }
 
 void intra16x16_plane(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int H = 0, V = 0;
   int a, b, c;
   int i, j;
@@ -1014,8 +1115,8 @@ Predictor get_intra16x16_predictor(
   std::experimental::optional<std::reference_wrapper<Block16x16>> u,
   std::experimental::optional<std::reference_wrapper<Block16x16>> l) {
 
-  Predictor predictor(16);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor predictor;
+  std::array<int, 33>& p = predictor.pred_pel;
   // Check whether neighbors are available
   if (u) {
     Block16x16& tmp = *u;
@@ -1049,28 +1150,21 @@ Predictor get_intra16x16_predictor(
   return predictor;
 }
 
-/* Input 8x8 chroma block and its neighbors
+/* Input 8x8 chroma blocks and the predictors of their neighbors
  * do intra8x8 prediction which has 4 modes
- * overwrite residual on input block
+ * overwrite residuals on input blocks, the predictions on cr_pred and cb_pred
  * return the least cost mode
  */
-std::tuple<int, IntraChromaMode> intra8x8_chroma(Block8x8& cr_block,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cr_ul,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cr_u,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cr_l,
-  Block8x8& cb_block,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cb_ul,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cb_u,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cb_l) {
-
-  // Get Cr, Cb predictors
-  Predictor cr_predictor = get_intra8x8_chroma_predictor(cr_ul, cr_u, cr_l);
-  Predictor cb_predictor = get_intra8x8_chroma_predictor(cb_ul, cb_u, cb_l);
-
+std::tuple<int, IntraChromaMode> intra8x8_chroma(Block8x8& cr_block, const Predictor& cr_predictor, Block8x8& cr_pred,
+                                                  Block8x8& cb_block, const Predictor& cb_predictor, Block8x8& cb_pred) {
   int mode;
   IntraChromaMode best_mode = static_cast<IntraChromaMode>(0);
-  Block8x8 cr_pred, cb_pred, cr_residual, cb_residual;
-  int min_sad = (1 << 15), cr_sad, cb_sad, sad;
+  Block8x8 cr_candidate, cb_candidate;
+  Block8x8* cr_cur = &cr_candidate;
+  Block8x8* cb_cur = &cb_candidate;
+  Block8x8* cr_best = &cr_pred;
+  Block8x8* cb_best = &cb_pred;
+  int min_sad = std::numeric_limits<int>::max(), cr_sad, cb_sad, sad;
   // Run all modes to get least residual
   for (mode = 0; mode < 4; mode++) {
     if ((!cr_predictor.up_available   && (IntraChromaMode::VERTICAL   == static_cast<IntraChromaMode>(mode))) ||
@@ -1079,39 +1173,39 @@ std::tuple<int, IntraChromaMode> intra8x8_chroma(Block8x8& cr_block,
       continue;
     }
 
-    get_intra8x8_chroma(cr_pred, cr_predictor, static_cast<IntraChromaMode>(mode));
-    get_intra8x8_chroma(cb_pred, cb_predictor, static_cast<IntraChromaMode>(mode));
+    get_intra8x8_chroma(*cr_cur, cr_predictor, static_cast<IntraChromaMode>(mode));
+    get_intra8x8_chroma(*cb_cur, cb_predictor, static_cast<IntraChromaMode>(mode));
 
-    cr_sad = SAD(cr_block.begin(), cr_block.end(), cr_pred.begin(), cr_pred.begin());
-    cb_sad = SAD(cb_block.begin(), cb_block.end(), cb_pred.begin(), cb_pred.begin());
+    cr_sad = mode_cost8x8(cr_block.data(), cr_cur->data());
+    cb_sad = mode_cost8x8(cb_block.data(), cb_cur->data());
     sad = cr_sad + cb_sad;
     if (sad < min_sad) {
       min_sad = sad;
       best_mode = static_cast<IntraChromaMode>(mode);
-      std::copy(cr_pred.begin(), cr_pred.end(), cr_residual.begin());
-      std::copy(cb_pred.begin(), cb_pred.end(), cb_residual.begin());
+      std::swap(cr_cur, cr_best);
+      std::swap(cb_cur, cb_best);
     }
   }
-  std::copy(cr_residual.begin(), cr_residual.end(), cr_block.begin());
-  std::copy(cb_residual.begin(), cb_residual.end(), cb_block.begin());
+  // the I_PCM fallback thresholds are in SAD
+  if (ModeCost::metric != CostMetric::ABS_DIFF)
+    min_sad = sad8x8(cr_block.data(), cr_best->data()) + sad8x8(cb_block.data(), cb_best->data());
+
+  // the winning predictions are kept for the reconstruction
+  if (cr_best != &cr_pred) {
+    cr_pred = *cr_best;
+    cb_pred = *cb_best;
+  }
+  get_residual(cr_block.data(), cr_block.data(), cr_pred.data(), 64);
+  get_residual(cb_block.data(), cb_block.data(), cb_pred.data(), 64);
 
   return std::make_tuple(min_sad, best_mode);
 }
 
-/* Input residual, neighbors and prediction mode
- * overwrite reconstructed block on resudual
+/* Input residual and the prediction of the chosen mode
+ * overwrite the reconstructed block, clipped to [16, 240], on the residual
  */
-void intra8x8_chroma_reconstruct(Block8x8& block,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> ul,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> u,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> l,
-  const IntraChromaMode mode) {
-
-  Block8x8 pred;
-  Predictor predictor = get_intra8x8_chroma_predictor(ul, u, l);
-  get_intra8x8_chroma(pred, predictor, mode);
-
-  std::transform(block.begin(), block.end(), pred.begin(), block.begin(), std::plus<int>());
+void intra8x8_chroma_reconstruct(Block8x8& block, const Block8x8& pred) {
+  get_reconstruction(block.data(), pred.data(), 64, 240);
 }
 
 /* Input predictors and mode
@@ -1135,7 +1229,7 @@ void get_intra8x8_chroma(Block8x8& pred, const Predictor& p, const IntraChromaMo
 }
 
 void intra8x8_chroma_dc(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int s1 = 0, s2 = 0, s3 = 0, s4 = 0;
   int s_upper_left = 0, s_upper_right = 0, s_down_left = 0, s_down_right = 0;
   int i, j;
@@ -1185,7 +1279,7 @@ void intra8x8_chroma_dc(Block8x8& pred, const Predictor& predictor) {
 }
 
 void intra8x8_chroma_horizontal(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i, j;
   for (i = 0; i < 8; i++) {
     for (j = 0; j < 8; j++) {
@@ -1195,7 +1289,7 @@ void intra8x8_chroma_horizontal(Block8x8& pred, const Predictor& predictor) {
 }
 
 void intra8x8_chroma_vertical(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int i;
   for (i = 0; i < 8; i++) {
     std::copy_n(p.begin()+1, 8, pred.begin()+i*8);
@@ -1203,7 +1297,7 @@ void intra8x8_chroma_vertical(Block8x8& pred, const Predictor& predictor) {
 }
 
 void intra8x8_chroma_plane(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+  const std::array<int, 33>& p = predictor.pred_pel;
   int H = 0, V = 0;
   int a, b, c;
   int i, j;
@@ -1237,8 +1331,8 @@ Predictor get_intra8x8_chroma_predictor(
   std::experimental::optional<std::reference_wrapper<Block8x8>> u,
   std::experimental::optional<std::reference_wrapper<Block8x8>> l) {
 
-  Predictor predictor(8);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor predictor;
+  std::array<int, 33>& p = predictor.pred_pel;
   // Check whether neighbors are available
   if (u) {
     Block8x8& tmp = *u;
@@ -109,54 +109,69 @@ PadFrame Reader::get_padded_frame() {
   return pf;
 }
 
-std::uint8_t Writer::stopcode[4] = {0x00, 0x00, 0x00, 0x01};
-
-Writer::Writer(std::string filename) {
-  // Open the file stream for output file
-  file.open(filename, std::ios::out | std::ios::binary);
-  if (!file.is_open()) {
-    logger.log(Level::ERROR, "Cannot open file");
-    exit(1);
-  }
-}
-
+/* Output name is a file, "-" for stdout or "|command" for a pipe,
+ * format is one of the containers known to open_muxer,
+ * cabac switches the slices from CAVLC (Baseline) to CABAC (Main)
+ */
+Writer::Writer(std::string filename, std::string format, const int fps, const int segment_frames, const bool cabac):
+  logger("Writer"), muxer(open_muxer(filename, format, fps, segment_frames)), entropy_coding_mode(cabac) {}
+
+Writer::Writer(std::unique_ptr<Sink> _sink, const bool cabac):
+  logger("Writer"), muxer(new AnnexBMuxer(std::move(_sink))), entropy_coding_mode(cabac) {}
+
+Writer::Writer(std::unique_ptr<Muxer> _muxer, const bool cabac):
+  logger("Writer"), muxer(std::move(_muxer)), entropy_coding_mode(cabac) {}
+
+/* SPS is kept until the PPS is ready,
+ * containers such as MP4 need both of them in their header
+ */
 void Writer::write_sps(const int width, const int height, const int num_frames) {
-  Bitstream output(stopcode, 32);
-  Bitstream rbsp = seq_parameter_set_rbsp(width, height, num_frames);
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::SPS, rbsp.rbsp_to_ebsp());
-
-  output += nal_unit.get();
-
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::SPS);
+  nal_unit.buffer += seq_parameter_set_rbsp(width, height, num_frames);
+  nal_unit.get();
+  sps = std::move(nal_unit.buffer);
+  this->width = width;
+  this->height = height;
 }
 
 void Writer::write_pps() {
-  Bitstream output(stopcode, 32);
-  Bitstream rbsp = pic_parameter_set_rbsp();
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::PPS, rbsp.rbsp_to_ebsp());
+  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::PPS);
+  nal_unit.buffer += pic_parameter_set_rbsp();
+  muxer->write_header(sps, nal_unit.get(), width, height);
+}
 
-  output += nal_unit.get();
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+/* The slice is written straight behind the NAL header,
+ * reserve enough room for all macroblocks up front.
+ * Only reads the Writer, so frame workers may call it concurrently
+ */
+Bitstream Writer::package_slice(const int frame_num, Frame& frame) const {
+  std::size_t rbsp_size = 16 + frame.mb_bitstream.buffer.size();
+  for (auto& mb : frame.mbs)
+    rbsp_size += mb.is_I_PCM ? 386 : 16;
+
+  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::IDR, rbsp_size);
+  slice_layer_without_partitioning_rbsp(frame_num, frame, nal_unit.buffer);
+  if (!entropy_coding_mode)
+    nal_unit.buffer += Bitstream((std::uint8_t)0x80, 8);
+  nal_unit.get();
+  return std::move(nal_unit.buffer);
 }
 
 void Writer::write_slice(const int frame_num, Frame& frame) {
-  Bitstream output(stopcode, 32);
-  Bitstream rbsp = slice_layer_without_partitioning_rbsp(frame_num, frame);
-  rbsp += Bitstream((std::uint8_t)0x80, 8);
-
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::IDR, rbsp.rbsp_to_ebsp());
+  Bitstream slice = package_slice(frame_num, frame);
+  write_slices({&slice});
+}
 
-  output += nal_unit.get();
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+/* Hand already packaged slices over to the container in frame order
+ */
+void Writer::write_slices(const std::vector<const Bitstream*>& slices) {
+  muxer->write_samples(slices);
 }
 
 Bitstream Writer::seq_parameter_set_rbsp(const int width, const int height, const int num_frames) {
   Bitstream sodb;
-  // only support baseline profile
-  std::uint8_t profile_idc = 66;  // u(8)
+  // baseline profile, main profile for CABAC
+  std::uint8_t profile_idc = entropy_coding_mode ? 77 : 66;  // u(8)
   bool constraint_set0_flag = false;  // u(1)
   bool constraint_set1_flag = false;  // u(1)
   bool constraint_set2_flag = false;  // u(1)
@@ -213,7 +228,8 @@ Bitstream Writer::seq_parameter_set_rbsp(const int width, const int height, cons
 
   sodb += Bitstream(vui_parameters_present_flag);
 
-  return sodb.rbsp_trailing_bits();
+  sodb.rbsp_trailing_bits();
+  return sodb;
 }
 
 Bitstream Writer::pic_parameter_set_rbsp() {
@@ -228,7 +244,7 @@ Bitstream Writer::pic_parameter_set_rbsp() {
 
   unsigned int pic_parameter_set_id = 0;  // ue(v)
   unsigned int seq_parameter_set_id = 0;  // ue(v)
-  bool entropy_coding_mode_flag = false;  // u(1)
+  bool entropy_coding_mode_flag = entropy_coding_mode;  // u(1)
   bool pic_order_present_flag = false;  // u(1)
   unsigned int num_slice_groups_minus1 = 0; // ue(v)
   unsigned int num_ref_idx_l0_active_minus1 = 0;  // ue(v)
@@ -258,30 +274,37 @@ Bitstream Writer::pic_parameter_set_rbsp() {
   sodb += Bitstream(constrained_intra_pred_flag);
   sodb += Bitstream(redundant_pic_cnt_present_flag);
 
-  return sodb.rbsp_trailing_bits();
+  sodb.rbsp_trailing_bits();
+  return sodb;
 }
 
-Bitstream Writer::slice_layer_without_partitioning_rbsp(const int _frame_num, Frame& frame) {
-  Bitstream sodb = slice_header(_frame_num);
-  return write_slice_data(frame, sodb).rbsp_trailing_bits();
+Bitstream& Writer::slice_layer_without_partitioning_rbsp(const int _frame_num, Frame& frame, Bitstream& sodb) const {
+  sodb += slice_header(_frame_num);
+  if (!entropy_coding_mode)
+    return write_slice_data(frame, sodb).rbsp_trailing_bits();
+
+  // cabac_alignment_one_bit, then the slice data coded by cabac_frame,
+  // which already ends with the rbsp trailing bits
+  if (!sodb.byte_align())
+    sodb += Bitstream(static_cast<std::uint8_t>(0xff), 8 - sodb.nb_bits % 8);
+  return sodb.append_aligned(frame.mb_bitstream.buffer.data(), frame.mb_bitstream.buffer.size());
 }
 
-Bitstream Writer::write_slice_data(Frame& frame, Bitstream& sodb) {
+Bitstream& Writer::write_slice_data(Frame& frame, Bitstream& sodb) const {
   for (auto& mb : frame.mbs) {
     if (mb.is_I_PCM) {
       sodb += ue(25);
 
-      while(!sodb.byte_align())
-        sodb += Bitstream(false);
-
-      for (auto& y : mb.Y)
-        sodb += Bitstream(static_cast<std::uint8_t>(y), 8);
-
-      for (auto& cb : mb.Cb)
-        sodb += Bitstream(static_cast<std::uint8_t>(cb), 8);
+      // pcm_alignment_zero_bit
+      if (!sodb.byte_align())
+        sodb += Bitstream(static_cast<std::uint8_t>(0), 8 - sodb.nb_bits % 8);
 
-      for (auto& cr : mb.Cr)
-        sodb += Bitstream(static_cast<std::uint8_t>(cr), 8);
+      // pcm_sample_luma, pcm_sample_chroma
+      std::uint8_t samples[256 + 64 + 64];
+      std::copy(mb.Y.begin(), mb.Y.end(), samples);
+      std::copy(mb.Cb.begin(), mb.Cb.end(), samples + 256);
+      std::copy(mb.Cr.begin(), mb.Cr.end(), samples + 256 + 64);
+      sodb.append_aligned(samples, sizeof(samples));
 
       continue;
     }
@@ -324,48 +347,19 @@ Bitstream Writer::write_slice_data(Frame& frame, Bitstream& sodb) {
 
     if (mb.coded_block_pattern_luma || mb.coded_block_pattern_chroma_DC || mb.coded_block_pattern_chroma_AC || mb.is_intra16x16) {
       sodb += se(0);
-      sodb += mb.bitstream;
+      sodb.append(frame.mb_bitstream.buffer.data() + mb.bitstream_offset, mb.bitstream_bits);
     }
   }
 
   return sodb;
 }
 
-Bitstream Writer::mb_pred(MacroBlock& mb, Frame& frame) {
+Bitstream Writer::mb_pred(MacroBlock& mb, Frame& frame) const {
   Bitstream sodb;
 
   if (!mb.is_intra16x16) {
     for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
-      int real_pos = MacroBlock::convert_table[cur_pos];
-
-      int pmA_index, pmA_pos;
-      if (real_pos % 4 == 0) {
-        pmA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-        pmA_pos = real_pos + 3;
-      } else {
-        pmA_index = mb.mb_index;
-        pmA_pos = real_pos - 1;
-      }
-      pmA_pos = MacroBlock::convert_table[pmA_pos];
-
-      int pmB_index, pmB_pos;
-      if (0 <= real_pos && real_pos <= 3) {
-        pmB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-        pmB_pos = 12 + real_pos;
-      } else {
-        pmB_index = mb.mb_index;
-        pmB_pos = real_pos - 4;
-      }
-      pmB_pos = MacroBlock::convert_table[pmB_pos];
-
-      int pred_modeA = 2, pred_modeB = 2;
-      if (pmA_index != -1 && (!frame.mbs.at(pmA_index).is_intra16x16) && (!frame.mbs.at(pmA_index).is_I_PCM)
-          && pmB_index != -1 && (!frame.mbs.at(pmB_index).is_intra16x16) && (!frame.mbs.at(pmB_index).is_I_PCM)) {
-        pred_modeA = static_cast<int>(frame.mbs.at(pmA_index).intra4x4_Y_mode.at(pmA_pos));
-        pred_modeB = static_cast<int>(frame.mbs.at(pmB_index).intra4x4_Y_mode.at(pmB_pos));
-      }
-
-      int pred_mode = std::min(pred_modeA, pred_modeB);
+      int pred_mode = frame.predict_intra4x4_mode(mb, cur_pos);
       int cur_mode = static_cast<int>(mb.intra4x4_Y_mode.at(cur_pos));
       if (pred_mode == cur_mode) {
         sodb += Bitstream(true);
@@ -384,7 +378,7 @@ Bitstream Writer::mb_pred(MacroBlock& mb, Frame& frame) {
   return sodb;
 }
 
-Bitstream Writer::slice_header(const int _frame_num) {
+Bitstream Writer::slice_header(const int _frame_num) const {
   Bitstream sodb;
 
   unsigned int first_mb_in_slice = 0;  // ue(v)
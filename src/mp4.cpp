@@ -0,0 +1,301 @@
+#include "mp4.h"
+#include "nal.h"
+
+static const std::size_t start_code_size = sizeof(NALUnit::start_code);
+
+static const std::uint32_t unity_matrix[9] = {
+  0x00010000, 0, 0,
+  0, 0x00010000, 0,
+  0, 0, 0x40000000
+};
+
+void BoxWriter::u8(const std::uint8_t value) {
+  buffer.push_back(value);
+}
+
+void BoxWriter::u16(const std::uint16_t value) {
+  u8(value >> 8);
+  u8(value);
+}
+
+void BoxWriter::u24(const std::uint32_t value) {
+  u8(value >> 16);
+  u16(value);
+}
+
+void BoxWriter::u32(const std::uint32_t value) {
+  u16(value >> 16);
+  u16(value);
+}
+
+void BoxWriter::u64(const std::uint64_t value) {
+  u32(value >> 32);
+  u32(value);
+}
+
+void BoxWriter::fourcc(const char* code) {
+  bytes(reinterpret_cast<const std::uint8_t*>(code), 4);
+}
+
+void BoxWriter::bytes(const std::uint8_t* data, const std::size_t size) {
+  buffer.insert(buffer.end(), data, data + size);
+}
+
+void BoxWriter::zeros(const std::size_t size) {
+  buffer.insert(buffer.end(), size, 0);
+}
+
+void BoxWriter::open(const char* type) {
+  boxes.push_back(buffer.size());
+  u32(0);
+  fourcc(type);
+}
+
+void BoxWriter::open_full(const char* type, const std::uint8_t version, const std::uint32_t flags) {
+  open(type);
+  u8(version);
+  u24(flags);
+}
+
+void BoxWriter::close() {
+  std::size_t begin = boxes.back();
+  std::uint32_t size = buffer.size() - begin;
+  boxes.pop_back();
+
+  buffer[begin] = size >> 24;
+  buffer[begin + 1] = size >> 16;
+  buffer[begin + 2] = size >> 8;
+  buffer[begin + 3] = size;
+}
+
+MP4Muxer::MP4Muxer(std::unique_ptr<Sink> _sink, const int fps): sink(std::move(_sink)) {
+  timescale = fps * 1000;
+  sample_duration = 1000;
+  sequence_number = 0;
+  decode_time = 0;
+}
+
+/* AVCDecoderConfigurationRecord
+ * SPS and PPS are stored without start code
+ */
+void MP4Muxer::write_avcc(BoxWriter& box, const Bitstream& sps, const Bitstream& pps) {
+  const std::uint8_t* sps_nal = sps.buffer.data() + start_code_size;
+  const std::size_t sps_size = sps.buffer.size() - start_code_size;
+  const std::uint8_t* pps_nal = pps.buffer.data() + start_code_size;
+  const std::size_t pps_size = pps.buffer.size() - start_code_size;
+
+  box.open("avcC");
+  box.u8(1);  // configurationVersion
+  box.u8(sps_nal[1]); // AVCProfileIndication
+  box.u8(sps_nal[2]); // profile_compatibility
+  box.u8(sps_nal[3]); // AVCLevelIndication
+  box.u8(0xfc | 3); // lengthSizeMinusOne
+  box.u8(0xe0 | 1); // numOfSequenceParameterSets
+  box.u16(sps_size);
+  box.bytes(sps_nal, sps_size);
+  box.u8(1);  // numOfPictureParameterSets
+  box.u16(pps_size);
+  box.bytes(pps_nal, pps_size);
+  box.close();
+}
+
+/* ftyp and moov
+ * the sample tables stay empty, samples are described by the fragments
+ */
+void MP4Muxer::write_header(const Bitstream& sps, const Bitstream& pps, const int width, const int height) {
+  BoxWriter box;
+
+  box.open("ftyp");
+  box.fourcc("iso5");
+  box.u32(512);
+  box.fourcc("iso5");
+  box.fourcc("iso6");
+  box.fourcc("avc1");
+  box.fourcc("mp41");
+  box.close();
+
+  box.open("moov");
+
+  box.open_full("mvhd", 0, 0);
+  box.u32(0); // creation_time
+  box.u32(0); // modification_time
+  box.u32(timescale);
+  box.u32(0); // duration
+  box.u32(0x00010000);  // rate
+  box.u16(0x0100);  // volume
+  box.zeros(10);
+  for (auto value : unity_matrix)
+    box.u32(value);
+  box.zeros(24);
+  box.u32(2); // next_track_ID
+  box.close();
+
+  box.open("trak");
+
+  box.open_full("tkhd", 0, 0x000003);  // enabled, in movie
+  box.u32(0); // creation_time
+  box.u32(0); // modification_time
+  box.u32(1); // track_ID
+  box.u32(0);
+  box.u32(0); // duration
+  box.zeros(8);
+  box.u16(0); // layer
+  box.u16(0); // alternate_group
+  box.u16(0); // volume
+  box.u16(0);
+  for (auto value : unity_matrix)
+    box.u32(value);
+  box.u32(width << 16);
+  box.u32(height << 16);
+  box.close();
+
+  box.open("mdia");
+
+  box.open_full("mdhd", 0, 0);
+  box.u32(0); // creation_time
+  box.u32(0); // modification_time
+  box.u32(timescale);
+  box.u32(0); // duration
+  box.u16(0x55c4);  // language "und"
+  box.u16(0);
+  box.close();
+
+  box.open_full("hdlr", 0, 0);
+  box.u32(0);
+  box.fourcc("vide");
+  box.zeros(12);
+  box.bytes(reinterpret_cast<const std::uint8_t*>("VideoHandler"), 13);
+  box.close();
+
+  box.open("minf");
+
+  box.open_full("vmhd", 0, 1);
+  box.zeros(8);
+  box.close();
+
+  box.open("dinf");
+  box.open_full("dref", 0, 0);
+  box.u32(1);
+  box.open_full("url ", 0, 1);  // media data in the same file
+  box.close();
+  box.close();
+  box.close();
+
+  box.open("stbl");
+
+  box.open_full("stsd", 0, 0);
+  box.u32(1);
+  box.open("avc1");
+  box.zeros(6);
+  box.u16(1); // data_reference_index
+  box.zeros(16);
+  box.u16(width);
+  box.u16(height);
+  box.u32(0x00480000);  // horizresolution, 72 dpi
+  box.u32(0x00480000);  // vertresolution, 72 dpi
+  box.u32(0);
+  box.u16(1); // frame_count
+  box.zeros(32);  // compressorname
+  box.u16(0x0018);  // depth
+  box.u16(0xffff);  // pre_defined
+  write_avcc(box, sps, pps);
+  box.close();
+  box.close();
+
+  for (auto type : {"stts", "stsc", "stco"}) {
+    box.open_full(type, 0, 0);
+    box.u32(0);
+    box.close();
+  }
+  box.open_full("stsz", 0, 0);
+  box.u32(0);
+  box.u32(0);
+  box.close();
+
+  box.close();  // stbl
+  box.close();  // minf
+  box.close();  // mdia
+  box.close();  // trak
+
+  box.open("mvex");
+  box.open_full("trex", 0, 0);
+  box.u32(1); // track_ID
+  box.u32(1); // default_sample_description_index
+  box.u32(sample_duration);
+  box.u32(0); // default_sample_size
+  box.u32(0); // default_sample_flags, every sample is a sync sample
+  box.close();
+  box.close();
+
+  box.close();  // moov
+
+  sink->write(box.buffer.data(), box.buffer.size());
+}
+
+/* One fragment per batch
+ *
+ * moof and the mdat header are built in memory, the samples are written
+ * from the NAL unit buffers directly behind their length prefixes.
+ */
+void MP4Muxer::write_samples(const std::vector<const Bitstream*>& samples) {
+  BoxWriter box;
+  std::size_t mdat_size = 8;
+  for (auto sample : samples)
+    mdat_size += sample->buffer.size();
+
+  box.open("moof");
+
+  box.open_full("mfhd", 0, 0);
+  box.u32(++sequence_number);
+  box.close();
+
+  box.open("traf");
+
+  box.open_full("tfhd", 0, 0x020000);  // default-base-is-moof
+  box.u32(1); // track_ID
+  box.close();
+
+  box.open_full("tfdt", 1, 0);
+  box.u64(decode_time);
+  box.close();
+
+  box.open_full("trun", 0, 0x000201);  // data-offset, sample-size
+  box.u32(samples.size());
+  std::size_t data_offset = box.buffer.size();
+  box.u32(0);
+  for (auto sample : samples)
+    box.u32(sample->buffer.size());
+  box.close();
+
+  box.close();  // traf
+  box.close();  // moof
+
+  // data_offset points at the first sample behind the mdat header
+  std::uint32_t offset = box.buffer.size() + 8;
+  for (int i = 0; i != 4; i++)
+    box.buffer[data_offset + i] = offset >> (24 - 8 * i);
+
+  box.u32(mdat_size);
+  box.fourcc("mdat");
+
+  // 4-byte NAL length in place of each start code
+  std::vector<std::uint8_t> lengths(samples.size() * start_code_size);
+  std::vector<struct iovec> iov;
+  iov.reserve(1 + samples.size() * 2);
+  iov.push_back({box.buffer.data(), box.buffer.size()});
+  for (std::size_t i = 0; i != samples.size(); i++) {
+    const Bitstream& nal = *samples[i];
+    std::uint32_t size = nal.buffer.size() - start_code_size;
+    std::uint8_t* length = lengths.data() + i * start_code_size;
+    length[0] = size >> 24;
+    length[1] = size >> 16;
+    length[2] = size >> 8;
+    length[3] = size;
+
+    iov.push_back({length, start_code_size});
+    iov.push_back({const_cast<std::uint8_t*>(nal.buffer.data()) + start_code_size, size});
+  }
+  sink->write(iov.data(), iov.size());
+
+  decode_time += static_cast<std::uint64_t>(sample_duration) * samples.size();
+}
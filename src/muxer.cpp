@@ -0,0 +1,48 @@
+#include "muxer.h"
+#include "mp4.h"
+#include "ts.h"
+#include "log.h"
+
+AnnexBMuxer::AnnexBMuxer(std::unique_ptr<Sink> _sink): sink(std::move(_sink)) {}
+
+void AnnexBMuxer::write_header(const Bitstream& sps, const Bitstream& pps, const int, const int) {
+  struct iovec iov[2] = {
+    {const_cast<std::uint8_t*>(sps.buffer.data()), sps.buffer.size()},
+    {const_cast<std::uint8_t*>(pps.buffer.data()), pps.buffer.size()}
+  };
+  sink->write(iov, 2);
+}
+
+/* Emit the NAL units in order with a single gather write
+ */
+void AnnexBMuxer::write_samples(const std::vector<const Bitstream*>& samples) {
+  std::vector<struct iovec> iov;
+  iov.reserve(samples.size());
+  for (auto sample : samples)
+    iov.push_back({const_cast<std::uint8_t*>(sample->buffer.data()), sample->buffer.size()});
+  sink->write(iov.data(), iov.size());
+}
+
+/* Open the muxer for the given output name and format
+ *   "264"  raw H.264 byte stream
+ *   "mp4"  fragmented MP4
+ *   "ts"   MPEG-TS, cut into HLS segments of segment_frames if > 0
+ * the MP4 timescale and the TS timestamps are derived from fps
+ */
+std::unique_ptr<Muxer> open_muxer(const std::string& name, const std::string& format, const int fps,
+                                  const int segment_frames) {
+  if (fps < 1 && format != "264") {
+    Log("Muxer").log(Level::ERROR, "Frame rate must be at least 1, got " + std::to_string(fps));
+    exit(1);
+  }
+
+  if (format == "264")
+    return std::unique_ptr<Muxer>(new AnnexBMuxer(open_sink(name)));
+  if (format == "mp4")
+    return std::unique_ptr<Muxer>(new MP4Muxer(open_sink(name), fps));
+  if (format == "ts")
+    return std::unique_ptr<Muxer>(new TSMuxer(name, fps, segment_frames));
+
+  Log("Muxer").log(Level::ERROR, "Unknown output format " + format);
+  exit(1);
+}
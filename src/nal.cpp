@@ -1,13 +1,23 @@
 #include "nal.h"
 
+std::uint8_t NALUnit::start_code[4] = {0x00, 0x00, 0x00, 0x01};
+
 /* Construct NAL unit 
- * given ref, type and RBSP
+ * given ref, type and the expected RBSP size in bytes
+ *
+ * The start code and NAL header are written in front, the caller
+ * appends the RBSP to buffer afterwards.
  */
-NALUnit::NALUnit(const NALRefIdc ref_idc, const NALType type, const Bitstream& rbsp) {
+NALUnit::NALUnit(const NALRefIdc ref_idc, const NALType type, const std::size_t rbsp_size) {
   forbidden_zero_bit = 0;
   nal_ref_idc = ref_idc;
   nal_unit_type = type;
-  buffer = rbsp;
+  is_ebsp = false;
+
+  // leave some room for emulation_prevention_three_byte
+  buffer.reserve(header_size + rbsp_size + rbsp_size / 64);
+  buffer += Bitstream(start_code, 32);
+  buffer += Bitstream(nal_header(), 8);
 }
 
 /* Return NAL header 
@@ -23,9 +33,12 @@ std::uint8_t NALUnit::nal_header() {
 }
 
 /* Return NAL unit bitstream
+ * the RBSP is converted to EBSP in place behind the header on first call
  */
-Bitstream NALUnit::get() {
-  std::uint8_t header[] = {nal_header()};
-  Bitstream output(header, 8);
-  return output + buffer;
-}
\ No newline at end of file
+const Bitstream& NALUnit::get() {
+  if (!is_ebsp) {
+    buffer.rbsp_to_ebsp(header_size);
+    is_ebsp = true;
+  }
+  return buffer;
+}
@@ -317,9 +317,11 @@ void inverse_hadamard2x2(const int mat_x[][2], int mat_z[][2]) {
 /* Quantized discrete cosine transformation
  *
  * The interface of forward or inverse QDCT, apply on each 4x4 block
+ * return the nonzero mask of the quantized blocks
  */
 template <typename T>
-inline void forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
+inline int forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
+  int nonzero_mask = 0;
 
   // source 4x4 block, target 4x4 block
   int mat_x[4][4], mat_z[4][4];
@@ -353,6 +355,9 @@ inline void forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
     }
     forward_hadamard4x4(mat16, mat_x);
     forward_DC_quantize4x4(mat_x, mat16, QP);
+    for (int i = 0; i < 16; i++)
+      if (mat16[i / 4][i % 4] != 0)
+        nonzero_mask |= QDCT_DC_NONZERO;
   }
   else { // BLOCK_SIZE = 8
     int mat_p[2][2];
@@ -363,6 +368,9 @@ inline void forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
     }
     forward_hadamard2x2(mat8, mat_p);
     forward_quantize2x2(mat_p, mat8, QP);
+    for (int i = 0; i < 4; i++)
+      if (mat8[i / 2][i % 2] != 0)
+        nonzero_mask |= QDCT_DC_NONZERO;
   }
 
   // Apply 4x4 quantization 16 times on 16x16 block
@@ -377,11 +385,16 @@ inline void forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
       // Apply 4x4 core transform
       forward_quantize4x4(mat_x, mat_z, QP);
 
-      // Write back from 4x4 matrix
+      // Write back from 4x4 matrix, the DC is replaced below
+      bool nonzero = false;
       for (int y = 0; y < 4; y++) {
-        for (int x = 0; x < 4; x++)
+        for (int x = 0; x < 4; x++) {
           block[i+j+y*BLOCK_SIZE+x] = mat_z[y][x];
+          nonzero |= (y != 0 || x != 0) && mat_z[y][x] != 0;
+        }
       }
+      if (nonzero)
+        nonzero_mask |= 1 << (i / (BLOCK_SIZE*4) * (BLOCK_SIZE/4) + j / 4);
     }
   }
 
@@ -397,9 +410,11 @@ inline void forward_qdct(T& block, const int BLOCK_SIZE, const int QP) {
         block[i*4*BLOCK_SIZE + j*4] = mat8[i][j];
     }
   }
+
+  return nonzero_mask;
 }
 
-inline void forward_qdct4x4(Block4x4 block, const int QP) {
+inline bool forward_qdct4x4(Block4x4 block, const int QP) {
 
   // source 4x4 block, target 4x4 block
   int mat_x[4][4], mat_z[4][4];
@@ -407,7 +422,7 @@ inline void forward_qdct4x4(Block4x4 block, const int QP) {
   // Copy into 4x4 matrix
   for (int y = 0; y < 4; y++) {
     for (int x = 0; x < 4; x++)
-      mat_x[y][x] = block[y*4+x];
+      mat_x[y][x] = block(y, x);
   }
 
   // Apply 4x4 core transform
@@ -415,10 +430,14 @@ inline void forward_qdct4x4(Block4x4 block, const int QP) {
   forward_quantize4x4(mat_z, mat_x, QP);
 
   // Write back from 4x4 matrix
+  bool nonzero = false;
   for (int y = 0; y < 4; y++) {
-    for (int x = 0; x < 4; x++)
-      block[y*4+x] = mat_x[y][x];
+    for (int x = 0; x < 4; x++) {
+      block(y, x) = mat_x[y][x];
+      nonzero |= mat_x[y][x] != 0;
+    }
   }
+  return nonzero;
 }
 
 inline void inverse_qdct4x4(Block4x4 block, const int QP) {
@@ -429,7 +448,7 @@ inline void inverse_qdct4x4(Block4x4 block, const int QP) {
   // Copy into 4x4 matrix
   for (int y = 0; y < 4; y++) {
     for (int x = 0; x < 4; x++)
-      mat_x[y][x] = block[y*4+x];
+      mat_x[y][x] = block(y, x);
   }
 
   // Apply 4x4 core transform
@@ -439,22 +458,28 @@ inline void inverse_qdct4x4(Block4x4 block, const int QP) {
   // Write back from 4x4 matrix
   for (int y = 0; y < 4; y++) {
     for (int x = 0; x < 4; x++)
-      block[y*4+x] = mat_x[y][x];
+      block(y, x) = mat_x[y][x];
   }
 }
 
 /* Inversed quantized discrete cosine transformation
  *
  * The interface of forward or inverse QDCT, apply on each 4x4 block
+ *
+ * Blocks without AC coefficient in nonzero_mask only hold their DC,
+ * which the inverse transform spreads evenly, so they are filled
+ * directly. Without any DC coefficient the DC transform is skipped.
  */
 template <typename T>
-inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
+inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP, const int nonzero_mask) {
 
   // source 4x4 block, target 4x4 block
   int mat_x[4][4], mat_z[4][4];
 
-  int mat16[4][4], mat8[2][2];
-  if (BLOCK_SIZE == 16) {
+  // all DC coefficients zero stay zero
+  int mat16[4][4] = {}, mat8[2][2] = {};
+  bool has_DC = nonzero_mask & QDCT_DC_NONZERO;
+  if (has_DC && BLOCK_SIZE == 16) {
     for (int i = 0; i < 4; i++) {
       for (int j = 0; j < 4; j++) {
         mat16[i][j] = block[i*4*BLOCK_SIZE + j*4];
@@ -464,7 +489,7 @@ inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
     inverse_hadamard4x4(mat16, mat_z);
     inverse_DC_quantize4x4(mat_z, mat16, QP);
   }
-  else { // BLOCK_SIZE = 8
+  else if (has_DC) { // BLOCK_SIZE = 8
     int mat_p[2][2];
     for (int i = 0; i < 2; i++) {
       for (int j = 0; j < 2; j++) {
@@ -478,6 +503,9 @@ inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
   // Apply 4x4 core transform 16 times on 16x16 block
   for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i += BLOCK_SIZE*4) {
     for (int j = 0; j < BLOCK_SIZE; j += 4) {
+      if (!(nonzero_mask & (1 << (i / (BLOCK_SIZE*4) * (BLOCK_SIZE/4) + j / 4))))
+        continue;
+
       // Copy into 4x4 matrix
       for (int y = 0; y < 4; y++) {
         for (int x = 0; x < 4; x++)
@@ -511,6 +539,15 @@ inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
   // Apply 4x4 quantization 16 times on 16x16 block
   for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i += BLOCK_SIZE*4) {
     for (int j = 0; j < BLOCK_SIZE; j += 4) {
+      if (!(nonzero_mask & (1 << (i / (BLOCK_SIZE*4) * (BLOCK_SIZE/4) + j / 4)))) {
+        int dc = (block[i+j] + 32) >> 6;
+        for (int y = 0; y < 4; y++) {
+          for (int x = 0; x < 4; x++)
+            block[i+j+y*BLOCK_SIZE+x] = dc;
+        }
+        continue;
+      }
+
       // Copy into 4x4 matrix
       for (int y = 0; y < 4; y++) {
         for (int x = 0; x < 4; x++)
@@ -529,20 +566,20 @@ inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
   }
 }
 
-void qdct_luma16x16_intra(Block16x16& block) {
-  forward_qdct(block, 16, LUMA_QP);
+int qdct_luma16x16_intra(Block16x16& block) {
+  return forward_qdct(block, 16, LUMA_QP);
 }
-void qdct_chroma8x8_intra(Block8x8& block) {
-  forward_qdct(block, 8, CHROMA_QP);
+int qdct_chroma8x8_intra(Block8x8& block) {
+  return forward_qdct(block, 8, CHROMA_QP);
 }
-void qdct_luma4x4_intra(Block4x4 block) {
-  forward_qdct4x4(block, LUMA_QP);
+bool qdct_luma4x4_intra(Block4x4 block) {
+  return forward_qdct4x4(block, LUMA_QP);
 }
-void inv_qdct_luma16x16_intra(Block16x16& block) {
-  inverse_qdct(block, 16, LUMA_QP);
+void inv_qdct_luma16x16_intra(Block16x16& block, const int nonzero_mask) {
+  inverse_qdct(block, 16, LUMA_QP, nonzero_mask);
 }
-void inv_qdct_chroma8x8_intra(Block8x8& block) {
-  inverse_qdct(block, 8, CHROMA_QP);
+void inv_qdct_chroma8x8_intra(Block8x8& block, const int nonzero_mask) {
+  inverse_qdct(block, 8, CHROMA_QP, nonzero_mask);
 }
 void inv_qdct_luma4x4_intra(Block4x4 block) {
   inverse_qdct4x4(block, LUMA_QP);
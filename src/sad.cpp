@@ -0,0 +1,298 @@
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "sad.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EN_SCALAR_SAD)
+#define SAD_SIMD
+#include <immintrin.h>
+#endif
+
+/* Scalar SAD, the reference for the SIMD kernels
+ */
+static int sad_c(const int* a, const int* b, const int n) {
+  int sad = 0;
+  for (int i = 0; i < n; i++)
+    sad += std::abs(a[i] - b[i]);
+  return sad;
+}
+
+#ifdef SAD_SIMD
+/* Four samples per step, |x| as (x ^ sign) - sign
+ * n is a multiple of 4
+ */
+__attribute__((target("sse2")))
+static int sad_sse2(const int* a, const int* b, const int n) {
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < n; i += 4) {
+    __m128i diff = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    __m128i sign = _mm_srai_epi32(diff, 31);
+    sum = _mm_add_epi32(sum, _mm_sub_epi32(_mm_xor_si128(diff, sign), sign));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum);
+}
+
+/* Eight samples per step with two accumulators
+ * n is a multiple of 16
+ */
+__attribute__((target("avx2")))
+static int sad_avx2(const int* a, const int* b, const int n) {
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  for (int i = 0; i < n; i += 16) {
+    const __m256i* pa = reinterpret_cast<const __m256i*>(a + i);
+    const __m256i* pb = reinterpret_cast<const __m256i*>(b + i);
+    sum0 = _mm256_add_epi32(sum0, _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb))));
+    sum1 = _mm256_add_epi32(sum1, _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256(pa + 1), _mm256_loadu_si256(pb + 1))));
+  }
+  __m256i sum256 = _mm256_add_epi32(sum0, sum1);
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+/* Pick the kernels for this CPU once
+ * 4x4 blocks are too short for AVX2 to pay off
+ */
+using SADKernel = int (*)(const int*, const int*, const int);
+
+static SADKernel select_sad(const bool wide) {
+#ifdef SAD_SIMD
+  __builtin_cpu_init();
+  if (wide && __builtin_cpu_supports("avx2"))
+    return sad_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return sad_sse2;
+#endif
+  (void)wide;
+  return sad_c;
+}
+
+static const SADKernel sad_narrow = select_sad(false);
+static const SADKernel sad_wide = select_sad(true);
+
+static inline int sad_n(const SADKernel kernel, const int* a, const int* b, const int n) {
+  int sad = kernel(a, b, n);
+#ifdef EN_DBG_SAD_SIMD
+  if (sad != sad_c(a, b, n)) {
+    Log("SAD").log(Level::ERROR, "SIMD SAD differs from the scalar SAD");
+    exit(1);
+  }
+#endif
+  return sad;
+}
+
+int sad4x4(const int* a, const int* b) {
+  return sad_n(sad_narrow, a, b, 16);
+}
+
+int sad8x8(const int* a, const int* b) {
+  return sad_n(sad_wide, a, b, 64);
+}
+
+int sad16x16(const int* a, const int* b) {
+  return sad_n(sad_wide, a, b, 256);
+}
+
+/* 4x4 Hadamard of the difference, rows of the blocks are stride apart
+ */
+static int satd4x4_c(const int* a, const int* b, const int stride) {
+  int t[16];
+  for (int i = 0; i < 4; i++) {
+    int d0 = a[i * stride] - b[i * stride];
+    int d1 = a[i * stride + 1] - b[i * stride + 1];
+    int d2 = a[i * stride + 2] - b[i * stride + 2];
+    int d3 = a[i * stride + 3] - b[i * stride + 3];
+    int s01 = d0 + d1, d01 = d0 - d1, s23 = d2 + d3, d23 = d2 - d3;
+    t[i * 4] = s01 + s23;
+    t[i * 4 + 1] = s01 - s23;
+    t[i * 4 + 2] = d01 - d23;
+    t[i * 4 + 3] = d01 + d23;
+  }
+
+  int satd = 0;
+  for (int j = 0; j < 4; j++) {
+    int s01 = t[j] + t[4 + j], d01 = t[j] - t[4 + j];
+    int s23 = t[8 + j] + t[12 + j], d23 = t[8 + j] - t[12 + j];
+    satd += std::abs(s01 + s23) + std::abs(s01 - s23) + std::abs(d01 - d23) + std::abs(d01 + d23);
+  }
+  return satd >> 1;
+}
+
+#ifdef SAD_SIMD
+__attribute__((target("sse2")))
+static inline void hadamard4_sse2(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3) {
+  __m128i s01 = _mm_add_epi32(r0, r1), d01 = _mm_sub_epi32(r0, r1);
+  __m128i s23 = _mm_add_epi32(r2, r3), d23 = _mm_sub_epi32(r2, r3);
+  r0 = _mm_add_epi32(s01, s23);
+  r1 = _mm_sub_epi32(s01, s23);
+  r2 = _mm_sub_epi32(d01, d23);
+  r3 = _mm_add_epi32(d01, d23);
+}
+
+/* Column transform on the rows as they are, transpose, row transform
+ */
+__attribute__((target("sse2")))
+static int satd4x4_sse2(const int* a, const int* b, const int stride) {
+  __m128i r[4];
+  for (int i = 0; i < 4; i++)
+    r[i] = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * stride)),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * stride)));
+  hadamard4_sse2(r[0], r[1], r[2], r[3]);
+
+  __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]), t1 = _mm_unpackhi_epi32(r[0], r[1]);
+  __m128i t2 = _mm_unpacklo_epi32(r[2], r[3]), t3 = _mm_unpackhi_epi32(r[2], r[3]);
+  r[0] = _mm_unpacklo_epi64(t0, t2);
+  r[1] = _mm_unpackhi_epi64(t0, t2);
+  r[2] = _mm_unpacklo_epi64(t1, t3);
+  r[3] = _mm_unpackhi_epi64(t1, t3);
+  hadamard4_sse2(r[0], r[1], r[2], r[3]);
+
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < 4; i++) {
+    __m128i sign = _mm_srai_epi32(r[i], 31);
+    sum = _mm_add_epi32(sum, _mm_sub_epi32(_mm_xor_si128(r[i], sign), sign));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum) >> 1;
+}
+#endif
+
+using SATDKernel = int (*)(const int*, const int*, const int);
+
+static SATDKernel select_satd() {
+#ifdef SAD_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    return satd4x4_sse2;
+#endif
+  return satd4x4_c;
+}
+
+static const SATDKernel satd_kernel = select_satd();
+
+/* SATD of a size x size block, 4x4 blocks at a time
+ */
+static int satd_n(const int* a, const int* b, const int size) {
+  int satd = 0;
+  for (int y = 0; y < size; y += 4) {
+    for (int x = 0; x < size; x += 4) {
+      int offset = y * size + x;
+      int block_satd = satd_kernel(a + offset, b + offset, size);
+#ifdef EN_DBG_SAD_SIMD
+      if (block_satd != satd4x4_c(a + offset, b + offset, size)) {
+        Log("SAD").log(Level::ERROR, "SIMD SATD differs from the scalar SATD");
+        exit(1);
+      }
+#endif
+      satd += block_satd;
+    }
+  }
+  return satd;
+}
+
+int satd4x4(const int* a, const int* b) {
+  return satd_n(a, b, 4);
+}
+
+int satd8x8(const int* a, const int* b) {
+  return satd_n(a, b, 8);
+}
+
+int satd16x16(const int* a, const int* b) {
+  return satd_n(a, b, 16);
+}
+
+CostMetric ModeCost::metric = CostMetric::ABS_DIFF;
+
+int mode_cost4x4(const int* a, const int* b) {
+  return (ModeCost::metric == CostMetric::HADAMARD) ? satd4x4(a, b) : sad4x4(a, b);
+}
+
+int mode_cost8x8(const int* a, const int* b) {
+  return (ModeCost::metric == CostMetric::HADAMARD) ? satd8x8(a, b) : sad8x8(a, b);
+}
+
+int mode_cost16x16(const int* a, const int* b) {
+  return (ModeCost::metric == CostMetric::HADAMARD) ? satd16x16(a, b) : sad16x16(a, b);
+}
+
+/* residual = block - pred, of the winning mode only
+ */
+void get_residual(int* residual, const int* block, const int* pred, const int n) {
+  for (int i = 0; i < n; i++)
+    residual[i] = block[i] - pred[i];
+}
+
+/* Scalar reconstruction, the reference for the SIMD kernel
+ */
+static void reconstruction_c(int* block, const int* pred, const int n, const int upper) {
+  for (int i = 0; i < n; i++)
+    block[i] = std::max(16, std::min(upper, block[i] + pred[i]));
+}
+
+#ifdef SAD_SIMD
+/* Eight samples per step, clipped in 16 bits
+ * the sums saturate far outside [16, upper], n is a multiple of 4
+ */
+__attribute__((target("sse2")))
+static void reconstruction_sse2(int* block, const int* pred, const int n, const int upper) {
+  const __m128i lower_bound = _mm_set1_epi16(16);
+  const __m128i upper_bound = _mm_set1_epi16(upper);
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i)),
+                               _mm_loadu_si128(reinterpret_cast<const __m128i*>(pred + i)));
+    __m128i hi = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i + 4)),
+                               _mm_loadu_si128(reinterpret_cast<const __m128i*>(pred + i + 4)));
+    __m128i clipped = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), lower_bound), upper_bound);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(block + i), _mm_unpacklo_epi16(clipped, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(block + i + 4), _mm_unpackhi_epi16(clipped, zero));
+  }
+  if (i < n) {
+    __m128i sum = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(pred + i)));
+    __m128i clipped = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(sum, sum), lower_bound), upper_bound);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(block + i), _mm_unpacklo_epi16(clipped, zero));
+  }
+}
+#endif
+
+using ReconstructionKernel = void (*)(int*, const int*, const int, const int);
+
+static ReconstructionKernel select_reconstruction() {
+#ifdef SAD_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    return reconstruction_sse2;
+#endif
+  return reconstruction_c;
+}
+
+static const ReconstructionKernel reconstruction_kernel = select_reconstruction();
+
+/* block = clip(block + pred) to [16, upper] in place, the inverse
+ * transformed residual of the winning mode and its prediction in one pass
+ */
+void get_reconstruction(int* block, const int* pred, const int n, const int upper) {
+#ifdef EN_DBG_SAD_SIMD
+  std::vector<int> expected(block, block + n);
+  reconstruction_c(expected.data(), pred, n, upper);
+#endif
+  reconstruction_kernel(block, pred, n, upper);
+#ifdef EN_DBG_SAD_SIMD
+  if (!std::equal(expected.begin(), expected.end(), block)) {
+    Log("SAD").log(Level::ERROR, "SIMD reconstruction differs from the scalar one");
+    exit(1);
+  }
+#endif
+}
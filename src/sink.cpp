@@ -0,0 +1,101 @@
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sink.h"
+
+void Sink::write(const std::uint8_t* data, const std::size_t size) {
+  struct iovec iov = {const_cast<std::uint8_t*>(data), size};
+  write(&iov, 1);
+}
+
+FileSink::FileSink(const std::string& filename): logger("FileSink") {
+  fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    logger.log(Level::ERROR, "Cannot open file " + filename);
+    exit(1);
+  }
+}
+
+FileSink::FileSink(const int _fd): logger("FileSink"), fd(_fd) {}
+
+FileSink::~FileSink() {
+  if (fd >= 0)
+    close(fd);
+}
+
+/* Gather write
+ * retry on short writes until all ranges are written
+ */
+void FileSink::write(const struct iovec* iov, const int iovcnt) {
+  std::vector<struct iovec> rest(iov, iov + iovcnt);
+  struct iovec* cur = rest.data();
+  int nb_left = iovcnt;
+
+  while (nb_left > 0) {
+    ssize_t n = writev(fd, cur, std::min(nb_left, IOV_MAX));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      logger.log(Level::ERROR, std::string("Cannot write output: ") + std::strerror(errno));
+      exit(1);
+    }
+
+    // skip what has been written
+    while (nb_left > 0 && static_cast<std::size_t>(n) >= cur->iov_len) {
+      n -= cur->iov_len;
+      cur++;
+      nb_left--;
+    }
+    if (nb_left > 0) {
+      cur->iov_base = static_cast<std::uint8_t*>(cur->iov_base) + n;
+      cur->iov_len -= n;
+    }
+  }
+}
+
+StdoutSink::StdoutSink(): FileSink(dup(STDOUT_FILENO)) {
+  if (fd < 0) {
+    logger.log(Level::ERROR, "Cannot open stdout");
+    exit(1);
+  }
+  std::fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+PipeSink::PipeSink(const std::string& command): FileSink(-1) {
+  pipe = popen(command.c_str(), "w");
+  if (pipe == nullptr) {
+    logger.log(Level::ERROR, "Cannot run " + command);
+    exit(1);
+  }
+  fd = fileno(pipe);
+}
+
+PipeSink::~PipeSink() {
+  // pclose closes the descriptor and waits for the command
+  fd = -1;
+  pclose(pipe);
+}
+
+void MemorySink::write(const struct iovec* iov, const int iovcnt) {
+  for (int i = 0; i < iovcnt; i++) {
+    const std::uint8_t* data = static_cast<const std::uint8_t*>(iov[i].iov_base);
+    buffer.insert(buffer.end(), data, data + iov[i].iov_len);
+  }
+}
+
+/* Open the sink for the given output name
+ *   "-"         stdout
+ *   "|command"  pipe into command
+ *   otherwise   regular file
+ */
+std::unique_ptr<Sink> open_sink(const std::string& name) {
+  if (name == "-")
+    return std::unique_ptr<Sink>(new StdoutSink());
+  if (!name.empty() && name[0] == '|')
+    return std::unique_ptr<Sink>(new PipeSink(name.substr(1)));
+  return std::unique_ptr<Sink>(new FileSink(name));
+}
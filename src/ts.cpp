@@ -0,0 +1,287 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <sys/uio.h>
+
+#include "ts.h"
+
+static const std::uint8_t access_unit_delimiter[6] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+
+// PTS runs this far ahead of the PCR, in 90 kHz ticks
+static const std::uint64_t pts_delay = 9000;
+
+/* CRC-32/MPEG-2 of a PSI section
+ */
+static std::uint32_t crc32(const std::uint8_t* data, const std::size_t size) {
+  std::uint32_t crc = 0xffffffff;
+  for (std::size_t i = 0; i != size; i++) {
+    crc ^= static_cast<std::uint32_t>(data[i]) << 24;
+    for (int bit = 0; bit != 8; bit++)
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+  }
+  return crc;
+}
+
+/* Append one TS packet header
+ *
+ * The adaptation field carries the PCR if pcr >= 0 and is padded with
+ * stuffing bytes so that the packet is full. Returns the payload size.
+ */
+static int ts_packet_header(std::vector<std::uint8_t>& out, const int pid, const bool start,
+                            std::uint8_t& continuity, const std::int64_t pcr, const std::size_t remaining) {
+  const int min_field = pcr >= 0 ? 8 : 0;
+  const int payload = std::min<std::size_t>(remaining, TSMuxer::packet_size - 4 - min_field);
+  const int field = TSMuxer::packet_size - 4 - payload;
+
+  out.push_back(0x47);
+  out.push_back((start ? 0x40 : 0x00) | (pid >> 8));
+  out.push_back(pid & 0xff);
+  out.push_back((field > 0 ? 0x30 : 0x10) | continuity);
+  continuity = (continuity + 1) & 0x0f;
+
+  if (field > 0) {
+    out.push_back(field - 1);
+    if (field > 1) {
+      std::size_t stuffing = field - 2;
+      if (pcr >= 0) {
+        // random_access_indicator, PCR_flag
+        out.push_back(0x50);
+        out.push_back(pcr >> 25);
+        out.push_back(pcr >> 17);
+        out.push_back(pcr >> 9);
+        out.push_back(pcr >> 1);
+        out.push_back(((pcr & 1) << 7) | 0x7e);
+        out.push_back(0x00);
+        stuffing -= 6;
+      } else {
+        out.push_back(0x00);
+      }
+      out.insert(out.end(), stuffing, 0xff);
+    }
+  }
+  return payload;
+}
+
+TSMuxer::TSMuxer(const std::string& _name, const int _fps, const int _segment_frames):
+  logger("TSMuxer"), name(_name), fps(_fps), segment_frames(_segment_frames) {
+  std::memset(continuity, 0, sizeof(continuity));
+  nb_frames = 0;
+  segment_nb_frames = 0;
+
+  if (segment_frames > 0) {
+    if (name == "-" || name.empty() || name[0] == '|') {
+      logger.log(Level::ERROR, "Segmented output needs a file name");
+      exit(1);
+    }
+    std::size_t dot = name.rfind('.');
+    std::size_t slash = name.rfind('/');
+    stem = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? name : name.substr(0, dot);
+  } else {
+    sink = open_sink(name);
+  }
+}
+
+TSMuxer::~TSMuxer() {
+  if (segment_frames > 0) {
+    if (sink)
+      close_segment();
+    write_playlist(true);
+  }
+}
+
+std::string TSMuxer::segment_name(const std::size_t index) {
+  return stem + std::to_string(index) + ".ts";
+}
+
+void TSMuxer::open_segment() {
+  sink = open_sink(segment_name(segments.size()));
+  segment_nb_frames = 0;
+}
+
+void TSMuxer::close_segment() {
+  sink.reset();
+  segments.push_back(segment_nb_frames);
+  segment_nb_frames = 0;
+  write_playlist(false);
+}
+
+/* Rewrite the playlist after every finished segment
+ * through a temporary file, readers never see a partial playlist
+ */
+void TSMuxer::write_playlist(const bool finished) {
+  std::string playlist = stem + ".m3u8";
+  std::string temp = playlist + ".tmp";
+  std::ofstream file(temp, std::ios::out | std::ios::trunc);
+  if (!file.is_open()) {
+    logger.log(Level::ERROR, "Cannot open playlist " + playlist);
+    exit(1);
+  }
+
+  int max_frames = segment_frames;
+  for (auto frames : segments)
+    max_frames = std::max(max_frames, frames);
+
+  file << "#EXTM3U\n";
+  file << "#EXT-X-VERSION:3\n";
+  file << "#EXT-X-TARGETDURATION:" << (max_frames + fps - 1) / fps << "\n";
+  file << "#EXT-X-MEDIA-SEQUENCE:0\n";
+  file << "#EXT-X-PLAYLIST-TYPE:" << (finished ? "VOD" : "EVENT") << "\n";
+
+  char duration[32];
+  for (std::size_t i = 0; i != segments.size(); i++) {
+    std::string uri = segment_name(i);
+    std::size_t slash = uri.rfind('/');
+    if (slash != std::string::npos)
+      uri = uri.substr(slash + 1);
+
+    std::snprintf(duration, sizeof(duration), "%.3f", static_cast<double>(segments[i]) / fps);
+    file << "#EXTINF:" << duration << ",\n" << uri << "\n";
+  }
+  if (finished)
+    file << "#EXT-X-ENDLIST\n";
+  file.close();
+
+  if (std::rename(temp.c_str(), playlist.c_str()) != 0) {
+    logger.log(Level::ERROR, "Cannot write playlist " + playlist);
+    exit(1);
+  }
+}
+
+/* PSI section in a single packet
+ * section holds everything from table_id up to the CRC
+ */
+void TSMuxer::write_psi(const int pid, std::uint8_t& counter, const std::vector<std::uint8_t>& section) {
+  std::uint32_t crc = crc32(section.data(), section.size());
+
+  std::size_t begin = packets.size();
+  ts_packet_header(packets, pid, true, counter, -1, packet_size);
+  packets.push_back(0x00); // pointer_field
+  packets.insert(packets.end(), section.begin(), section.end());
+  for (int shift = 24; shift >= 0; shift -= 8)
+    packets.push_back(crc >> shift);
+  packets.resize(begin + packet_size, 0xff);
+}
+
+void TSMuxer::write_pat_pmt() {
+  const std::vector<std::uint8_t> pat = {
+    0x00, // table_id
+    0xb0, 13, // section_syntax_indicator, section_length
+    0x00, 0x01,  // transport_stream_id
+    0xc1, // version_number 0, current_next_indicator
+    0x00, 0x00,  // section_number, last_section_number
+    0x00, 0x01,  // program_number
+    0xe0 | (pmt_pid >> 8), pmt_pid & 0xff
+  };
+  write_psi(0, continuity[0], pat);
+
+  const std::vector<std::uint8_t> pmt = {
+    0x02, // table_id
+    0xb0, 18, // section_syntax_indicator, section_length
+    0x00, 0x01,  // program_number
+    0xc1, // version_number 0, current_next_indicator
+    0x00, 0x00,  // section_number, last_section_number
+    0xe0 | (video_pid >> 8), video_pid & 0xff,  // PCR_PID
+    0xf0, 0x00,  // program_info_length
+    0x1b, // stream_type, H.264
+    0xe0 | (video_pid >> 8), video_pid & 0xff,
+    0xf0, 0x00  // ES_info_length
+  };
+  write_psi(pmt_pid, continuity[1], pmt);
+}
+
+/* One frame as one PES packet
+ *
+ * AUD, optionally SPS/PPS, then the slice. The pieces are copied
+ * straight into the TS packets, 184 bytes at a time.
+ */
+void TSMuxer::write_pes(const Bitstream& slice, const bool with_parameter_sets) {
+  const std::uint64_t pcr = nb_frames * 90000 / fps;
+  const std::uint64_t pts = pcr + pts_delay;
+
+  const std::uint8_t pes_header[14] = {
+    0x00, 0x00, 0x01, 0xe0,  // start code, video stream
+    0x00, 0x00, // PES_packet_length, unbounded
+    0x80, // marker bits
+    0x80, // PTS only
+    0x05, // PES_header_data_length
+    static_cast<std::uint8_t>(0x21 | ((pts >> 29) & 0x0e)),
+    static_cast<std::uint8_t>(pts >> 22),
+    static_cast<std::uint8_t>((pts >> 14) | 0x01),
+    static_cast<std::uint8_t>(pts >> 7),
+    static_cast<std::uint8_t>((pts << 1) | 0x01)
+  };
+
+  std::vector<struct iovec> pieces;
+  pieces.push_back({const_cast<std::uint8_t*>(pes_header), sizeof(pes_header)});
+  pieces.push_back({const_cast<std::uint8_t*>(access_unit_delimiter), sizeof(access_unit_delimiter)});
+  if (with_parameter_sets) {
+    pieces.push_back({sps.buffer.data(), sps.buffer.size()});
+    pieces.push_back({pps.buffer.data(), pps.buffer.size()});
+  }
+  pieces.push_back({const_cast<std::uint8_t*>(slice.buffer.data()), slice.buffer.size()});
+
+  std::size_t remaining = 0;
+  for (auto& piece : pieces)
+    remaining += piece.iov_len;
+
+  packets.reserve(packets.size() + (remaining / 176 + 1) * packet_size);
+
+  auto piece = pieces.begin();
+  std::size_t piece_offset = 0;
+  bool start = true;
+  while (remaining > 0) {
+    std::size_t payload = ts_packet_header(packets, video_pid, start, continuity[2],
+                                           start ? static_cast<std::int64_t>(pcr) : -1, remaining);
+    remaining -= payload;
+    start = false;
+
+    while (payload > 0) {
+      std::size_t n = std::min(payload, piece->iov_len - piece_offset);
+      const std::uint8_t* data = static_cast<const std::uint8_t*>(piece->iov_base) + piece_offset;
+      packets.insert(packets.end(), data, data + n);
+      payload -= n;
+      piece_offset += n;
+      if (piece_offset == piece->iov_len) {
+        piece++;
+        piece_offset = 0;
+      }
+    }
+  }
+}
+
+void TSMuxer::write_header(const Bitstream& _sps, const Bitstream& _pps, const int, const int) {
+  sps = _sps;
+  pps = _pps;
+}
+
+/* Packetize the batch into one buffer and write it at once,
+ * switching to a new segment file whenever the current one is full
+ */
+void TSMuxer::write_samples(const std::vector<const Bitstream*>& samples) {
+  packets.clear();
+  bool parameter_sets = nb_frames == 0;
+  if (segment_frames == 0)
+    write_pat_pmt();
+
+  for (auto sample : samples) {
+    if (segment_frames > 0 && (!sink || segment_nb_frames == segment_frames)) {
+      if (sink) {
+        sink->write(packets.data(), packets.size());
+        packets.clear();
+        close_segment();
+      }
+      open_segment();
+      write_pat_pmt();
+      parameter_sets = true;
+    }
+
+    write_pes(*sample, parameter_sets);
+    parameter_sets = false;
+    nb_frames++;
+    segment_nb_frames++;
+  }
+
+  if (!packets.empty())
+    sink->write(packets.data(), packets.size());
+}
@@ -1,4 +1,8 @@
 #include "util.h"
+#include "sad.h"
+#include "intra.h"
+#include "worker.h"
+#include "frame_cache.h"
 
 Util::Util(const int argc, const char *argv[]) {
   this->logger = Log("Util");
@@ -8,6 +12,13 @@ Util::Util(const int argc, const char *argv[]) {
                                              {"size", "0x0"},
                                              {"input", "snoopy.avi"},
                                              {"output", "snoopy.264"},
+                                             {"format", ""},
+                                             {"fps", "30"},
+                                             {"segment", "0"},
+                                             {"entropy", "cavlc"},
+                                             {"cost", "sad"},
+                                             {"intra4x4", "off"},
+                                             {"dedup", "off"},
                                              {"t", "-1"}};
 
   // get arguments from command line
@@ -56,5 +67,80 @@ Util::Util(const int argc, const char *argv[]) {
   this->output_file = options["output"];
   this->logger.log(Level::VERBOSE, "Setting output file to " + this->output_file);
 
+  // container format, guessed from the output extension unless given
+  this->output_format = options["format"];
+  if (this->output_format.empty()) {
+    std::size_t dot = this->output_file.rfind('.');
+    std::string extension = dot == std::string::npos ? "" : this->output_file.substr(dot + 1);
+    if (extension == "mp4")
+      this->output_format = "mp4";
+    else if (extension == "ts" || extension == "m3u8")
+      this->output_format = "ts";
+    else
+      this->output_format = "264";
+  }
+  this->logger.log(Level::VERBOSE, "Setting output format to " + this->output_format);
+
+  // frame rate of the container timeline, the timescale is derived from it
+  this->fps = std::stoi(options["fps"]);
+  if (this->fps < 1) {
+    this->logger.log(Level::ERROR, "Frame rate must be at least 1, got " + options["fps"]);
+    exit(1);
+  }
+  this->logger.log(Level::VERBOSE, "Setting frame rate to " + options["fps"]);
+  this->segment_frames = std::stoul(options["segment"]);
+
+  // entropy coder, CAVLC (Baseline) or CABAC (Main)
+  if (options["entropy"] != "cavlc" && options["entropy"] != "cabac") {
+    this->logger.log(Level::ERROR, "Unknown entropy coder " + options["entropy"]);
+    exit(1);
+  }
+  this->cabac = options["entropy"] == "cabac";
+  this->logger.log(Level::VERBOSE, "Setting entropy coder to " + options["entropy"]);
+
+  // cost metric of the intra mode decision
+  if (options["cost"] == "sad") {
+    ModeCost::metric = CostMetric::ABS_DIFF;
+  } else if (options["cost"] == "satd") {
+    ModeCost::metric = CostMetric::HADAMARD;
+  } else if (options["cost"] == "rd") {
+    ModeCost::metric = CostMetric::RATE_DISTORTION;
+  } else {
+    this->logger.log(Level::ERROR, "Unknown cost metric " + options["cost"]);
+    exit(1);
+  }
+  this->logger.log(Level::VERBOSE, "Setting mode decision cost to " + options["cost"]);
+
+  // intra 4x4 search, none, all modes or a pre-selected few
+  if (options["intra4x4"] == "off") {
+    IntraSearch::intra4x4 = Intra4x4Search::OFF;
+  } else if (options["intra4x4"] == "full") {
+    IntraSearch::intra4x4 = Intra4x4Search::FULL;
+  } else if (options["intra4x4"] == "fast") {
+    IntraSearch::intra4x4 = Intra4x4Search::FAST;
+  } else {
+    this->logger.log(Level::ERROR, "Unknown intra4x4 search " + options["intra4x4"]);
+    exit(1);
+  }
+#ifdef TEST4_THREAD_IN_ENCODE_Y_INTRA4x4_BLOCK
+  // the threaded 4x4 encode never writes its blocks back, only intra16x16 is coded
+  if (IntraSearch::intra4x4 != Intra4x4Search::OFF) {
+    this->logger.log(Level::ERROR, "intra4x4 search is not available with TEST4_THREAD_IN_ENCODE_Y_INTRA4x4_BLOCK");
+    exit(1);
+  }
+#endif
+  this->logger.log(Level::VERBOSE, "Setting intra4x4 search to " + options["intra4x4"]);
+
+  // reuse of frames and MB rows equal to the last coded frame
+  if (options["dedup"] == "off") {
+    FrameCache::enabled = false;
+  } else if (options["dedup"] == "on") {
+    FrameCache::enabled = true;
+  } else {
+    this->logger.log(Level::ERROR, "Unknown dedup setting " + options["dedup"]);
+    exit(1);
+  }
+  this->logger.log(Level::VERBOSE, "Setting dedup to " + options["dedup"]);
+
   this->test_frame = std::stoul(options["t"]);
 }
@@ -1,5 +1,12 @@
 #include "vlc.h"
+#include "log.h"
 #include <iostream>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EN_SCALAR_CAVLC)
+#define CAVLC_SSSE3
+#include <immintrin.h>
+#endif
 
 /* Zig-zag scan
  */
@@ -210,412 +217,435 @@ Bitstream se(const int codenum) {
   return ue(_codenum);
 }
 
-void scan_zigzag(Block4x4 block, int tblock[]) {
-  for (int i = 0; i < 16; i++)
-    tblock[mat_zigzag4x4[i]] = block[i];
+/* Length of ue(v) and se(v), 2 * floor(log2(codenum + 1)) + 1
+ */
+int ue_bits(const unsigned int codenum) {
+  return 2 * (31 - __builtin_clz(codenum + 1)) + 1;
 }
 
-void scan_zigzag(Block2x2 block, int tblock[]) {
-  tblock[0] = block[0];
-  tblock[1] = block[1];
-  tblock[2] = block[2];
-  tblock[3] = block[3];
+int se_bits(const int codenum) {
+  return ue_bits((codenum > 0) ? 2 * codenum - 1 : -2 * codenum);
 }
 
-std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int maxNumCoeff) {
-  int mat_x[16];
-  scan_zigzag(block, mat_x);
-
-  int total_coeff = 0;
-  int total_zeros = 0;
-  int trail_ones = 0;
-  int highest_idx = 0;
-
-  int coeff_table_idx = 5;
-  if (nC >= 0 && nC < 2)
-    coeff_table_idx = 0;
-  else if (nC >= 2 && nC < 4)
-    coeff_table_idx = 1;
-  else if (nC >= 4 && nC < 8)
-    coeff_table_idx = 2;
-  else if (nC >= 8)
-    coeff_table_idx = 3;
-  else if (nC == -1)
-    coeff_table_idx = 4;
+void scan_zigzag(const int raster[], int tblock[]) {
+  for (int i = 0; i < 16; i++)
+    tblock[mat_zigzag4x4[i]] = raster[i];
+}
 
-  // Get the highest frequency coeff
-  for (int i = 15; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      highest_idx = i;
-      break;
-    }
+/* Scalar zigzag scan with the nonzero / trailing one bitmaps
+ * the reference for the SIMD scan
+ */
+static void scan_block4x4_c(const int raster[], ScannedBlock& scan) {
+  scan_zigzag(raster, scan.coeff);
+  scan.nonzero = 0;
+  scan.ones = 0;
+  for (int i = 0; i < 16; i++) {
+    if (scan.coeff[i] != 0)
+      scan.nonzero |= 1 << i;
+    if (scan.coeff[i] == 1 || scan.coeff[i] == -1)
+      scan.ones |= 1 << i;
   }
+}
 
-  // Count TotalCoeff, TotalZeros
-  for (int i = 0; i <= highest_idx; i++) {
-    if (mat_x[i] != 0)
-      total_coeff++;
+#ifdef CAVLC_SSSE3
+/* pshufb masks of the zigzag scan over int16 coefficients
+ *   zigzag_shuffle[ half of the output ][ half of the input ]
+ * bytes taken from the other input half are zeroed (0x80)
+ */
+alignas(16) static std::uint8_t zigzag_shuffle[2][2][16];
+
+static bool init_zigzag_shuffle() {
+  std::memset(zigzag_shuffle, 0x80, sizeof(zigzag_shuffle));
+  for (int raster = 0; raster < 16; raster++) {
+    int scan = mat_zigzag4x4[raster];
+    for (int byte = 0; byte < 2; byte++)
+      zigzag_shuffle[scan / 8][raster / 8][(scan % 8) * 2 + byte] = (raster % 8) * 2 + byte;
   }
-  total_zeros = highest_idx - total_coeff + 1;
-  if (maxNumCoeff == 15 && total_zeros > 0)
-    total_zeros--;
+  return true;
+}
 
-  // Count trailing ones
-  std::string ones_str;
-  int resume_idx = highest_idx;
-  for (int i = highest_idx; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      if (mat_x[i] == 1) {
-        trail_ones++;
-        ones_str += "0";
-      }
-      else if (mat_x[i] == -1) {
-        trail_ones++;
-        ones_str += "1";
-      }
-      else {
-        resume_idx = i;
-        break;
-      }
+static const bool zigzag_shuffle_ready = init_zigzag_shuffle();
 
-      if (trail_ones == 3) {
-        resume_idx = i - 1;
-        break;
-      }
-    }
+/* Zigzag scan on packed int16 coefficients
+ *
+ * Quantized coefficients of 8-bit video fit in int16. The bitmaps come
+ * from movemask over the compared lanes, the scanned block is widened
+ * back to int for the level coding.
+ */
+__attribute__((target("ssse3")))
+static void scan_block4x4_ssse3(const int raster[], ScannedBlock& scan) {
+  const __m128i* in = reinterpret_cast<const __m128i*>(raster);
+  const __m128i in_lo = _mm_packs_epi32(_mm_loadu_si128(in), _mm_loadu_si128(in + 1));
+  const __m128i in_hi = _mm_packs_epi32(_mm_loadu_si128(in + 2), _mm_loadu_si128(in + 3));
+  const __m128i* shuffle = reinterpret_cast<const __m128i*>(zigzag_shuffle);
+
+  const __m128i lo = _mm_or_si128(_mm_shuffle_epi8(in_lo, _mm_load_si128(shuffle)),
+                                  _mm_shuffle_epi8(in_hi, _mm_load_si128(shuffle + 1)));
+  const __m128i hi = _mm_or_si128(_mm_shuffle_epi8(in_lo, _mm_load_si128(shuffle + 2)),
+                                  _mm_shuffle_epi8(in_hi, _mm_load_si128(shuffle + 3)));
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i is_zero = _mm_packs_epi16(_mm_cmpeq_epi16(lo, zero), _mm_cmpeq_epi16(hi, zero));
+  const __m128i is_one = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_abs_epi16(lo), one),
+                                         _mm_cmpeq_epi16(_mm_abs_epi16(hi), one));
+  scan.nonzero = ~_mm_movemask_epi8(is_zero) & 0xffff;
+  scan.ones = _mm_movemask_epi8(is_one);
+
+  __m128i* out = reinterpret_cast<__m128i*>(scan.coeff);
+  _mm_storeu_si128(out, _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16));
+  _mm_storeu_si128(out + 1, _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16));
+  _mm_storeu_si128(out + 2, _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16));
+  _mm_storeu_si128(out + 3, _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16));
+
+#ifdef EN_DBG_CAVLC_SIMD
+  ScannedBlock ref;
+  scan_block4x4_c(raster, ref);
+  if (std::memcmp(&ref, &scan, sizeof(ScannedBlock)) != 0) {
+    Log("VLC").log(Level::ERROR, "SIMD zigzag scan differs from the scalar scan");
+    exit(1);
   }
-  
-  // Level encoding
-  std::string level_vlc_str = "";
-  int lastCoeff = total_coeff - trail_ones;
-  if (lastCoeff > 0) {
-    int suffix_len = 0;
-    bool pad_this = (trail_ones < 3);
-
-    if (total_coeff > 10 && trail_ones < 3)
-      suffix_len = 1;
+#endif
+}
+#endif
 
-    for (int i = resume_idx; i >= 0; i--) {
-      if (mat_x[i] != 0) {
-        lastCoeff--;
-        int level_code = mat_x[i];
-
-        if (pad_this) {
-          if (mat_x[i] > 0)
-            level_code -= 1;
-          else
-            level_code += 1;
-          pad_this = false;
-        }
-
-        level_code *= 2;
-        if (level_code >= 0)
-          level_code -= 2;
-        else
-          level_code = 0 - (level_code + 1);
-
-        int level_prefix = 0;
-        std::string level_prefix_str = "";
-        bool solution_found = false;
-
-        while (!solution_found) {
-          int level_suffix_len = 0;
-          if (level_prefix == 14 && suffix_len == 0)
-            level_suffix_len = 4;
-          else {
-            if (level_prefix >= 15)
-              level_suffix_len = level_prefix - 3;
-            else
-              level_suffix_len = suffix_len;
-          }
-
-          if (level_prefix >= 16)
-            level_code -= (1 << (level_prefix - 3)) - 4096;
-
-          if (level_prefix >= 15 && suffix_len == 0)
-            level_code -= 15;
-
-          int level_code_prefix = std::min(15, level_prefix) * pow(2.0, suffix_len);
-          int level_suffix = level_code - level_code_prefix;
-          int level_max = pow(2.0, level_suffix_len) - 1;
-
-          if (level_suffix <= level_max) {
-            solution_found = true;
-            level_vlc_str += level_prefix_str + "1";
-            if (level_suffix_len != 0) {
-              std::string encoded_str;
-              if (level_suffix != 0) {
-                std::bitset<64> bits(level_suffix);
-                encoded_str = bits.to_string();
-                int first_one_pos = encoded_str.find_first_of("1");
-                encoded_str = encoded_str.substr(first_one_pos, 64 - first_one_pos);
-              }
-              else
-                encoded_str = "0";
-              while (encoded_str.length() < (unsigned int)level_suffix_len)
-                encoded_str = "0" + encoded_str;
-              level_vlc_str += encoded_str;
-            }
-
-            if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
-              suffix_len++;
-            if (lastCoeff == total_coeff - 1 - trail_ones && std::abs(mat_x[i]) > 3)
-              suffix_len = 2;
-          }
-          else {
-            level_prefix++;
-            level_prefix_str += "0";
-          }
-        }
-      }
-    }
-  }
+/* Pick the zigzag scan for this CPU once
+ */
+static void (*select_scan_block4x4())(const int[], ScannedBlock&) {
+#ifdef CAVLC_SSSE3
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))
+    return scan_block4x4_ssse3;
+#endif
+  return scan_block4x4_c;
+}
 
-  // Calculate run-before
-  std::string run_vlc_str = "";
-  int last_zeros = total_zeros;
-  int coeff_cnt = total_coeff - 1;
-
-  if (total_coeff == maxNumCoeff)
-    last_zeros = 0;
-
-  for (int i = 15; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      int zero_cnt = 0;
-      int j = i - 1;
-      for (; j >= 0; j--) {
-        if (mat_x[j] != 0)
-          break;
-        zero_cnt++;
-      }
+static void (*const scan_block4x4)(const int[], ScannedBlock&) = select_scan_block4x4();
 
-      if (j != -1) {
-        std::string run_str = "";
-        if (last_zeros <= 6)
-          run_str = run_vlc_table[zero_cnt][last_zeros];
-        else
-          run_str = run_vlc_table[zero_cnt][7];
-        last_zeros -= zero_cnt;
-        coeff_cnt--;
-        run_vlc_str += run_str;
-      }
-    }
+/* Table driven codes built from the string tables above
+ *
+ * coeff_token_code[ TableType ][ TotalCoeff ][ T1 ][ signs ]
+ *   coeff_token followed by the sign bits of the trailing ones,
+ *   signs holds them in bitstream order, 1 for a negative one
+ * total_zeros_code[ TotalCoeff ][ TotalZeros ]
+ * total_zeros_code2x2[ TotalCoeff ][ TotalZeros ]
+ * run_before_code[ min(ZerosLeft, 7) ][ RunBefore ]
+ */
+static VLCCode coeff_token_code[6][17][4][8];
+static VLCCode total_zeros_code[17][16];
+static VLCCode total_zeros_code2x2[4][4];
+static VLCCode run_before_code[8][15];
+
+static VLCCode to_code(const std::string& codeword) {
+  VLCCode code = {0, static_cast<int>(codeword.size())};
+  for (auto c : codeword)
+    code.code = (code.code << 1) | (c == '1');
+  return code;
+}
 
-    if (last_zeros == 0)
-      break;
-  }
+static bool init_vlc_tables() {
+  for (int table = 0; table != 6; table++)
+    for (int total_coeff = 0; total_coeff != 17; total_coeff++)
+      for (int trail_ones = 0; trail_ones != 4; trail_ones++) {
+        VLCCode token = to_code(num_vlc_table[table][total_coeff][trail_ones]);
+        for (int signs = 0; signs != (1 << trail_ones); signs++)
+          coeff_token_code[table][total_coeff][trail_ones][signs] =
+            {(token.code << trail_ones) | signs, token.nb_bits + trail_ones};
+      }
 
-  std::string final_str = num_vlc_table[coeff_table_idx][total_coeff][trail_ones] + ones_str + level_vlc_str;
-  if (total_coeff < maxNumCoeff)
-    final_str += zero_vlc_table[total_zeros][total_coeff];
-  final_str += run_vlc_str;
+  for (int total_zeros = 0; total_zeros != 16; total_zeros++)
+    for (int total_coeff = 0; total_coeff != 17; total_coeff++)
+      total_zeros_code[total_coeff][total_zeros] = to_code(zero_vlc_table[total_zeros][total_coeff]);
 
+  for (int total_zeros = 0; total_zeros != 4; total_zeros++)
+    for (int total_coeff = 0; total_coeff != 4; total_coeff++)
+      total_zeros_code2x2[total_coeff][total_zeros] = to_code(zero_vlc_table2x2[total_zeros][total_coeff]);
 
-  // if (total_coeff > 0) {
-  //  printf("[cavlc4x4] nC = %d, total_coeff = %d, trail_ones = %d\n", nC, total_coeff, trail_ones);
-  //  std::cout << "  coeff_token = " << num_vlc_table[coeff_table_idx][total_coeff][trail_ones] << std::endl;
-  //  std::cout << "  sign_ones   = " << ones_str << std::endl;
-  //  std::cout << "  level       = " << level_vlc_str << std::endl;
-  //  std::cout << "  zeros       = " << zero_vlc_table[total_zeros][total_coeff] << std::endl;
-  //  std::cout << "  run         = " << run_vlc_str << std::endl;
-    // std::cout << Bitstream(final_str).to_string() << std::endl;
-  // }
+  for (int run = 0; run != 15; run++)
+    for (int zeros_left = 0; zeros_left != 8; zeros_left++)
+      run_before_code[zeros_left][run] = to_code(run_vlc_table[run][zeros_left]);
 
-  return std::make_pair(Bitstream(final_str), total_coeff);
+  return true;
 }
 
-std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int maxNumCoeff) {
-  int mat_x[4];
-  scan_zigzag(block, mat_x);
-
-  int total_coeff = 0;
-  int total_zeros = 0;
-  int trail_ones = 0;
-  int highest_idx = 0;
+static const bool vlc_tables_ready = init_vlc_tables();
 
-  int coeff_table_idx = 5;
+static int coeff_token_table(const int nC) {
   if (nC >= 0 && nC < 2)
-    coeff_table_idx = 0;
+    return 0;
   else if (nC >= 2 && nC < 4)
-    coeff_table_idx = 1;
+    return 1;
   else if (nC >= 4 && nC < 8)
-    coeff_table_idx = 2;
+    return 2;
   else if (nC >= 8)
-    coeff_table_idx = 3;
+    return 3;
   else if (nC == -1)
-    coeff_table_idx = 4;
+    return 4;
+  return 5;
+}
 
-  // Get the highest frequency coeff
-  for (int i = 3; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      highest_idx = i;
-      break;
-    }
+/* level_prefix and level_suffix of one levelCode
+ *
+ * level_prefix 14 with a 4-bit suffix only exists for suffixLength 0,
+ * level_prefix 15 carries a 12-bit suffix. Larger levels escape to
+ * level_prefix 16 and up.
+ */
+static VLCCode level_vlc(const int level_code, const int suffix_len) {
+  int level_prefix, level_suffix, level_suffix_len;
+
+  if (suffix_len == 0 && level_code < 14) {
+    level_prefix = level_code;
+    level_suffix = 0;
+    level_suffix_len = 0;
+  } else if (suffix_len == 0 && level_code < 30) {
+    level_prefix = 14;
+    level_suffix = level_code - 14;
+    level_suffix_len = 4;
+  } else if (suffix_len != 0 && level_code < (15 << suffix_len)) {
+    level_prefix = level_code >> suffix_len;
+    level_suffix = level_code & ((1 << suffix_len) - 1);
+    level_suffix_len = suffix_len;
+  } else {
+    int escape = level_code - (15 << suffix_len) - (suffix_len == 0 ? 15 : 0);
+    level_prefix = 15;
+    while (escape - ((1 << (level_prefix - 3)) - 4096) >= (1 << (level_prefix - 3)))
+      level_prefix++;
+    level_suffix = escape - ((1 << (level_prefix - 3)) - 4096);
+    level_suffix_len = level_prefix - 3;
   }
 
-  // Count TotalCoeff, TotalZeros
-  for (int i = 0; i <= highest_idx; i++) {
-    if (mat_x[i] != 0)
-      total_coeff++;
+  return {(1u << level_suffix_len) | level_suffix, level_prefix + 1 + level_suffix_len};
+}
+
+/* level_vlc_table[ suffixLength ][ levelCode ]
+ * for the common range, larger levelCodes go through level_vlc()
+ */
+static const int level_table_size = 128;
+static VLCCode level_vlc_table[7][level_table_size];
+
+static bool init_level_tables() {
+  for (int suffix_len = 0; suffix_len != 7; suffix_len++)
+    for (int level_code = 0; level_code != level_table_size; level_code++)
+      level_vlc_table[suffix_len][level_code] = level_vlc(level_code, suffix_len);
+  return true;
+}
+
+static const bool level_tables_ready = init_level_tables();
+
+/* Bit sink of the CAVLC writers that only counts
+ * stands in for the Bitstream when only the cost of a block is wanted
+ */
+struct BitCounter {
+  int nb_bits = 0;
+
+  void put(const std::uint32_t, const int nb_put) {
+    nb_bits += nb_put;
   }
-  total_zeros = highest_idx - total_coeff + 1;
-
-  // Count trailing ones
-  std::string ones_str;
-  int resume_idx = highest_idx;
-  for (int i = highest_idx; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      if (mat_x[i] == 1) {
-        trail_ones++;
-        ones_str += "0";
-      }
-      else if (mat_x[i] == -1) {
-        trail_ones++;
-        ones_str += "1";
-      }
-      else {
-        resume_idx = i;
-        break;
-      }
+};
 
-      if (trail_ones == 3) {
-        resume_idx = i - 1;
-        break;
-      }
+/* Level encoding
+ * append level_prefix and level_suffix of the non trailing-one levels,
+ * their positions are the set bits of levels, highest first
+ */
+template <typename BitSink>
+static void cavlc_levels(BitSink& bitstream, const int mat_x[], std::uint32_t levels,
+                         const int total_coeff, const int trail_ones) {
+  if (total_coeff == trail_ones)
+    return;
+
+  int suffix_len = (total_coeff > 10 && trail_ones < 3) ? 1 : 0;
+  bool pad_this = (trail_ones < 3);
+
+  while (levels != 0) {
+    int i = 31 - __builtin_clz(levels);
+    levels &= ~(1u << i);
+    int level = mat_x[i];
+
+    int level_code = (level > 0) ? 2 * level - 2 : -2 * level - 1;
+    if (pad_this) {
+      level_code -= 2;
+      pad_this = false;
     }
+
+    const VLCCode code = (level_code < level_table_size) ? level_vlc_table[suffix_len][level_code]
+                                                          : level_vlc(level_code, suffix_len);
+    bitstream.put(code.code, code.nb_bits);
+
+    if (suffix_len == 0)
+      suffix_len = 1;
+    if (std::abs(level) > (3 << (suffix_len - 1)) && suffix_len < 6)
+      suffix_len++;
   }
- 
-  // Level encoding
-  std::string level_vlc_str = "";
-  int lastCoeff = total_coeff - trail_ones;
-  if (lastCoeff > 0) {
-    int suffix_len = 0;
-    bool pad_this = (trail_ones < 3);
-
-    for (int i = resume_idx; i >= 0; i--) {
-      if (mat_x[i] != 0) {
-        lastCoeff--;
-        int level_code = mat_x[i];
-
-        if (pad_this) {
-          if (mat_x[i] > 0)
-            level_code -= 1;
-          else
-            level_code += 1;
-          pad_this = false;
-        }
-
-        level_code *= 2;
-        if (level_code >= 0)
-          level_code -= 2;
-        else
-          level_code = 0 - (level_code + 1);
-
-        int level_prefix = 0;
-        std::string level_prefix_str = "";
-        bool solution_found = false;
-
-        while (!solution_found) {
-          int level_suffix_len = 0;
-          if (level_prefix == 14 && suffix_len == 0)
-            level_suffix_len = 4;
-          else {
-            if (level_prefix >= 15)
-              level_suffix_len = level_prefix - 3;
-            else
-              level_suffix_len = suffix_len;
-          }
-
-          if (level_prefix >= 16)
-            level_code -= (1 << (level_prefix - 3)) - 4096;
-
-          if (level_prefix >= 15 && suffix_len == 0)
-            level_code -= 15;
-
-          int level_code_prefix = std::min(15, level_prefix) * pow(2.0, suffix_len);
-          int level_suffix = level_code - level_code_prefix;
-          int level_max = pow(2.0, level_suffix_len) - 1;
-
-          if (level_suffix <= level_max) {
-            solution_found = true;
-            level_vlc_str += level_prefix_str + "1";
-            if (level_suffix_len != 0) {
-              std::string encoded_str;
-              if (level_suffix != 0) {
-                std::bitset<64> bits(level_suffix);
-                encoded_str = bits.to_string();
-                int first_one_pos = encoded_str.find_first_of("1");
-                encoded_str = encoded_str.substr(first_one_pos, 64 - first_one_pos);
-              }
-              else
-                encoded_str = "0";
-              while (encoded_str.length() < (unsigned int)level_suffix_len)
-                encoded_str = "0" + encoded_str;
-              level_vlc_str += encoded_str;
-            }
-
-            if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
-              suffix_len++;
-            if (lastCoeff == total_coeff - 1 - trail_ones && std::abs(mat_x[i]) > 3)
-              suffix_len = 2;
-          }
-          else {
-            level_prefix++;
-            level_prefix_str += "0";
-          }
-        }
-      }
-    }
+}
+
+/* CAVLC of one block of scanned coefficients
+ * shared by the 4x4 (nb_coeff 16) and the chroma DC 2x2 (nb_coeff 4) blocks,
+ * written into a Bitstream or a BitCounter, returns TotalCoeff
+ *
+ * TotalCoeff, TotalZeros, the trailing ones and the runs all come from
+ * the nonzero bitmap, the coefficients are only read for the levels.
+ */
+template <typename BitSink>
+static int cavlc_coeffs(BitSink& bitstream, const ScannedBlock& scan, const int nb_coeff, const int nC, const int maxNumCoeff) {
+  const std::uint32_t nonzero = scan.nonzero;
+
+  // Count TotalCoeff, TotalZeros up to the highest frequency coeff
+  int total_coeff = __builtin_popcount(nonzero);
+  int highest_idx = nonzero ? 31 - __builtin_clz(nonzero) : 0;
+  int total_zeros = highest_idx - total_coeff + 1;
+  if (maxNumCoeff == 15 && total_zeros > 0)
+    total_zeros--;
+
+  // Count trailing ones, collect their signs
+  int trail_ones = 0;
+  int signs = 0;
+  std::uint32_t levels = nonzero;
+  while (levels != 0 && trail_ones < 3) {
+    int i = 31 - __builtin_clz(levels);
+    if (!(scan.ones & (1u << i)))
+      break;
+    trail_ones++;
+    signs = (signs << 1) | (scan.coeff[i] < 0);
+    levels &= ~(1u << i);
   }
 
-  // Calculate run-before
-  std::string run_vlc_str = "";
-  int last_zeros = total_zeros;
-  int coeff_cnt = total_coeff - 1;
-
-  if (total_coeff == maxNumCoeff)
-    last_zeros = 0;
-
-  for (int i = 3; i >= 0; i--) {
-    if (mat_x[i] != 0) {
-      int zero_cnt = 0;
-      int j = i - 1;
-      for (; j >= 0; j--) {
-        if (mat_x[j] != 0)
-          break;
-        zero_cnt++;
-      }
+  const VLCCode& token = coeff_token_code[coeff_token_table(nC)][total_coeff][trail_ones][signs];
+  bitstream.put(token.code, token.nb_bits);
 
-      if (j != -1) {
-        std::string run_str = "";
-        if (last_zeros <= 6)
-          run_str = run_vlc_table[zero_cnt][last_zeros];
-        else
-          run_str = run_vlc_table[zero_cnt][7];
-        last_zeros -= zero_cnt;
-        coeff_cnt--;
-        run_vlc_str += run_str;
-      }
-    }
+  cavlc_levels(bitstream, scan.coeff, levels, total_coeff, trail_ones);
 
-    if (last_zeros == 0)
+  if (total_coeff < maxNumCoeff) {
+    const VLCCode& zeros = (nb_coeff == 4) ? total_zeros_code2x2[total_coeff][total_zeros]
+                                           : total_zeros_code[total_coeff][total_zeros];
+    bitstream.put(zeros.code, zeros.nb_bits);
+  }
+
+  // Calculate run-before, the gap down to the next lower coefficient
+  int zeros_left = (total_coeff == maxNumCoeff) ? 0 : total_zeros;
+  std::uint32_t runs = nonzero;
+  while (zeros_left != 0 && runs != 0) {
+    int i = 31 - __builtin_clz(runs);
+    runs &= ~(1u << i);
+    if (runs == 0)
       break;
+
+    int run_before = i - (31 - __builtin_clz(runs)) - 1;
+    const VLCCode& run = run_before_code[std::min(zeros_left, 7)][run_before];
+    bitstream.put(run.code, run.nb_bits);
+    zeros_left -= run_before;
   }
 
-  std::string final_str = num_vlc_table[coeff_table_idx][total_coeff][trail_ones] + ones_str + level_vlc_str;
-  if (total_coeff < maxNumCoeff)
-    final_str += zero_vlc_table2x2[total_zeros][total_coeff];
-  final_str += run_vlc_str;
+  return total_coeff;
+}
 
-  // if (total_coeff > 0) {
-  //  printf("[cavlc2x2] nC = %d, total_coeff = %d, trail_ones = %d\n", nC, total_coeff, trail_ones);
-  //  std::cout << "  coeff_token = " << num_vlc_table[coeff_table_idx][total_coeff][trail_ones] << std::endl;
-  //  std::cout << "  sign_ones   = " << ones_str << std::endl;
-  //  std::cout << "  level       = " << level_vlc_str << std::endl;
-  //  std::cout << "  zeros       = " << zero_vlc_table2x2[total_zeros][total_coeff] << std::endl;
-  //  std::cout << "  run         = " << run_vlc_str << std::endl;
-  // }
+/* coeff_token of a block without any coefficient
+ * the QDCT already knows which blocks are empty, no need to scan them
+ */
+Bitstream cavlc_empty_block(const int nC) {
+  const VLCCode& token = coeff_token_code[coeff_token_table(nC)][0][0][0];
+  Bitstream bitstream;
+  bitstream.put(token.code, token.nb_bits);
+  return bitstream;
+}
 
-  return std::make_pair(Bitstream(final_str), total_coeff);
+/* Zigzag scan with the bitmaps, shared with CABAC
+ */
+void scan_coeffs(Block4x4 block, ScannedBlock& scan) {
+  int raster[16];
+  block.copy_to(raster);
+  scan_block4x4(raster, scan);
 }
 
+// the DC slot is coded in the DC block
+void scan_coeffs(ACBlock4x4 block, ScannedBlock& scan) {
+  scan_coeffs(static_cast<Block4x4>(block), scan);
+  scan.coeff[0] = 0;
+  scan.nonzero &= ~1u;
+  scan.ones &= ~1u;
+}
+
+void scan_coeffs(LumaDCBlock block, ScannedBlock& scan) {
+  int raster[16];
+  block.copy_to(raster);
+  scan_block4x4(raster, scan);
+}
+
+void scan_coeffs(Block2x2 block, ScannedBlock& scan) {
+  block.copy_to(scan.coeff);
+  scan.nonzero = 0;
+  scan.ones = 0;
+  for (int i = 0; i < 4; i++) {
+    if (scan.coeff[i] != 0)
+      scan.nonzero |= 1 << i;
+    if (scan.coeff[i] == 1 || scan.coeff[i] == -1)
+      scan.ones |= 1 << i;
+  }
+}
+
+template <typename Block>
+static std::pair<Bitstream, int> cavlc_scanned_block4x4(Block block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  Bitstream bitstream;
+  int total_coeff = cavlc_coeffs(bitstream, scan, 16, nC, maxNumCoeff);
+  return std::make_pair(std::move(bitstream), total_coeff);
+}
+
+std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int maxNumCoeff) {
+  return cavlc_scanned_block4x4(block, nC, maxNumCoeff);
+}
+
+std::pair<Bitstream, int> cavlc_block4x4(ACBlock4x4 block, const int nC, const int maxNumCoeff) {
+  return cavlc_scanned_block4x4(block, nC, maxNumCoeff);
+}
+
+std::pair<Bitstream, int> cavlc_block4x4(LumaDCBlock block, const int nC, const int maxNumCoeff) {
+  return cavlc_scanned_block4x4(block, nC, maxNumCoeff);
+}
+
+std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  Bitstream bitstream;
+  int total_coeff = cavlc_coeffs(bitstream, scan, 4, nC, maxNumCoeff);
+  return std::make_pair(std::move(bitstream), total_coeff);
+}
+
+/* Bit cost of the CAVLC of a block, nothing is written
+ * the lengths come from the same tables as cavlc_block4x4 / cavlc_block2x2
+ */
+int cavlc_bits_empty_block(const int nC) {
+  return coeff_token_code[coeff_token_table(nC)][0][0][0].nb_bits;
+}
+
+int cavlc_bits_block4x4(const ScannedBlock& scan, const int nC, const int maxNumCoeff) {
+  BitCounter counter;
+  cavlc_coeffs(counter, scan, 16, nC, maxNumCoeff);
+  return counter.nb_bits;
+}
+
+int cavlc_bits_block4x4(Block4x4 block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  return cavlc_bits_block4x4(scan, nC, maxNumCoeff);
+}
+
+int cavlc_bits_block4x4(ACBlock4x4 block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  return cavlc_bits_block4x4(scan, nC, maxNumCoeff);
+}
+
+int cavlc_bits_block4x4(LumaDCBlock block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  return cavlc_bits_block4x4(scan, nC, maxNumCoeff);
+}
+
+int cavlc_bits_block2x2(Block2x2 block, const int nC, const int maxNumCoeff) {
+  ScannedBlock scan;
+  scan_coeffs(block, scan);
+  BitCounter counter;
+  cavlc_coeffs(counter, scan, 4, nC, maxNumCoeff);
+  return counter.nb_bits;
+}